@@ -825,6 +825,23 @@
 #define INSN_MASK_FENCE_TSO		0xffffffff
 #define INSN_MATCH_FENCE_TSO		0x8330000f
 
+#define INSN_MASK_CBO			0xfff07fff
+#define INSN_MATCH_CBO_INVAL		0x0000200f
+#define INSN_MATCH_CBO_CLEAN		0x0010200f
+#define INSN_MATCH_CBO_FLUSH		0x0020200f
+#define INSN_MATCH_CBO_ZERO		0x0040200f
+
+#define INSN_MASK_ADD			0xfe00707f
+#define INSN_MATCH_ADD			0x00000033
+#define INSN_MASK_ADDI			0x707f
+#define INSN_MATCH_ADDI			0x13
+#define INSN_MASK_BLTU			0x707f
+#define INSN_MATCH_BLTU			0x6063
+#define INSN_MASK_C_ADD			0xf003
+#define INSN_MATCH_C_ADD		0x9002
+#define INSN_MASK_C_ADDI		0xe003
+#define INSN_MATCH_C_ADDI		0x1
+
 #if __riscv_xlen == 64
 
 /* 64-bit read for VS-stage address translation (RV64) */
@@ -912,6 +929,12 @@
 #define IMM_I(insn)			((s32)(insn) >> 20)
 #define IMM_S(insn)			(((s32)(insn) >> 25 << 5) | \
 					 (s32)(((insn) >> 7) & 0x1f))
+#define IMM_B(insn)			(((s32)(insn) >> 31 << 12) | \
+					 (s32)(RV_X(insn, 7, 1) << 11) | \
+					 (s32)(RV_X(insn, 25, 6) << 5) | \
+					 (s32)(RV_X(insn, 8, 4) << 1))
+#define RVC_ADDI_IMM(insn)		((s32)((RV_X(insn, 12, 1) << 5) | \
+					       RV_X(insn, 2, 5)) << 26 >> 26)
 #define MASK_FUNCT3			0x7000
 
 /* clang-format on */
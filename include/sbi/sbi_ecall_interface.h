@@ -99,6 +99,31 @@
 #define SBI_EXT_PMU_COUNTER_START	0x3
 #define SBI_EXT_PMU_COUNTER_STOP	0x4
 #define SBI_EXT_PMU_COUNTER_FW_READ	0x5
+#define SBI_EXT_PMU_SNAPSHOT_SET_SHMEM	0x7
+
+/* SBI function IDs for OpenSBI BATCH extension */
+#define SBI_EXT_OPENSBI_BATCH_SET_SHMEM		0x0
+#define SBI_EXT_OPENSBI_BATCH_DOORBELL		0x1
+
+/* SBI function IDs for OpenSBI PMU_VMID extension */
+#define SBI_EXT_OPENSBI_PMU_VMID_READ		0x0
+#define SBI_EXT_OPENSBI_PMU_VMID_RELEASE	0x1
+
+/* Flags defined for OpenSBI PMU_VMID read function */
+#define SBI_OPENSBI_PMU_VMID_READ_FLAG_RESET	(1 << 0)
+
+/* SBI function IDs for OpenSBI FEATURE extension */
+#define SBI_EXT_OPENSBI_FEATURE_SET		0x0
+#define SBI_EXT_OPENSBI_FEATURE_GET		0x1
+
+/** Firmware features which can be toggled by the supervisor */
+enum sbi_opensbi_feature_id {
+	/* Delegate misaligned load/store exceptions of the calling hart */
+	SBI_OPENSBI_FEATURE_MISALIGNED_DELEG	= 0,
+	/* Timer slack of all harts in microseconds, root domain only */
+	SBI_OPENSBI_FEATURE_TIMER_SLACK		= 1,
+	SBI_OPENSBI_FEATURE_MAX,
+};
 
 /** General pmu event codes specified in SBI PMU extension */
 enum sbi_pmu_hw_generic_events_t {
@@ -182,6 +207,26 @@ enum sbi_pmu_fw_event_code_id {
 	SBI_PMU_FW_HFENCE_VVMA_ASID_SENT = 20,
 	SBI_PMU_FW_HFENCE_VVMA_ASID_RCVD = 21,
 	SBI_PMU_FW_MAX,
+
+	/* Implementation specific events, selected by event_data */
+	SBI_PMU_FW_PLATFORM		= 65535,
+};
+
+/**
+ * OpenSBI specific firmware events, passed as event_data with the
+ * SBI_PMU_FW_PLATFORM firmware event code.
+ */
+enum sbi_pmu_fw_opensbi_event_id {
+	SBI_PMU_FW_OPENSBI_TIMER_SKIPPED	= 0,
+
+	/* mcycle spent handling traps from lower privilege modes */
+	SBI_PMU_FW_OPENSBI_MCYCLE		= 1,
+	SBI_PMU_FW_OPENSBI_MCYCLE_ECALL		= 2,
+	SBI_PMU_FW_OPENSBI_MCYCLE_MISALIGNED	= 3,
+	SBI_PMU_FW_OPENSBI_MCYCLE_ILLEGAL_INSN	= 4,
+	SBI_PMU_FW_OPENSBI_MCYCLE_IPI		= 5,
+	SBI_PMU_FW_OPENSBI_MCYCLE_TIMER		= 6,
+	SBI_PMU_FW_OPENSBI_MAX,
 };
 
 /** SBI PMU event idx type */
@@ -226,9 +271,11 @@ enum sbi_pmu_ctr_type {
 
 /* Flags defined for counter start function */
 #define SBI_PMU_START_FLAG_SET_INIT_VALUE (1 << 0)
+#define SBI_PMU_START_FLAG_INIT_SNAPSHOT (1 << 1)
 
 /* Flags defined for counter stop function */
 #define SBI_PMU_STOP_FLAG_RESET (1 << 0)
+#define SBI_PMU_STOP_FLAG_TAKE_SNAPSHOT (1 << 1)
 
 /* SBI base specification related macros */
 #define SBI_SPEC_VERSION_MAJOR_OFFSET		24
@@ -239,6 +286,11 @@ enum sbi_pmu_ctr_type {
 #define SBI_EXT_FIRMWARE_START			0x0A000000
 #define SBI_EXT_FIRMWARE_END			0x0AFFFFFF
 
+/* OpenSBI firmware specific extension IDs */
+#define SBI_EXT_OPENSBI_BATCH			(SBI_EXT_FIRMWARE_START + 0x0)
+#define SBI_EXT_OPENSBI_FEATURE			(SBI_EXT_FIRMWARE_START + 0x1)
+#define SBI_EXT_OPENSBI_PMU_VMID		(SBI_EXT_FIRMWARE_START + 0x2)
+
 /* SBI return error codes */
 #define SBI_SUCCESS				0
 #define SBI_ERR_FAILED				-1
@@ -249,8 +301,9 @@ enum sbi_pmu_ctr_type {
 #define SBI_ERR_ALREADY_AVAILABLE		-6
 #define SBI_ERR_ALREADY_STARTED			-7
 #define SBI_ERR_ALREADY_STOPPED			-8
+#define SBI_ERR_NO_SHMEM			-9
 
-#define SBI_LAST_ERR				SBI_ERR_ALREADY_STOPPED
+#define SBI_LAST_ERR				SBI_ERR_NO_SHMEM
 
 /* clang-format on */
 
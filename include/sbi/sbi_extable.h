@@ -0,0 +1,60 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Exception table for M-mode accesses which are expected to fault.
+ */
+
+#ifndef __SBI_EXTABLE_H__
+#define __SBI_EXTABLE_H__
+
+#include <sbi/riscv_asm.h>
+
+/**
+ * Emit an exception table entry from inline assembly
+ *
+ * A trap taken in M-mode at address 'insn' resumes at address 'fixup'
+ * after the trap details have been stored in the struct sbi_trap_info
+ * pointed to by the A3 register of the faulting context.
+ */
+#define SBI_EXTABLE_ENTRY(insn, fixup)				\
+	".pushsection __sbi_extable, \"aw\"\n"			\
+	".balign " RISCV_SZPTR "\n"				\
+	RISCV_PTR " " #insn ", " #fixup "\n"			\
+	".popsection\n"
+
+#ifndef __ASSEMBLER__
+
+#include <sbi/sbi_types.h>
+
+struct sbi_trap_regs;
+struct sbi_trap_info;
+
+/** Representation of an exception table entry */
+struct sbi_extable_entry {
+	/** Address of the instruction which may fault */
+	unsigned long insn;
+	/** Address where execution continues after a fault */
+	unsigned long fixup;
+};
+
+/** Sort the exception table so that it can be searched quickly */
+void sbi_extable_init(void);
+
+/** Find exception table entry for given address or return NULL */
+const struct sbi_extable_entry *sbi_extable_search(unsigned long addr);
+
+/**
+ * Redirect a M-mode trap to the fixup address of the faulting instruction
+ *
+ * @param regs pointer to register state of the faulting context
+ * @param trap pointer to trap details
+ *
+ * @return 0 on success and SBI_ENOENT if the faulting instruction has
+ * no exception table entry
+ */
+int sbi_extable_fixup(struct sbi_trap_regs *regs,
+		      const struct sbi_trap_info *trap);
+
+#endif
+
+#endif
@@ -64,6 +64,8 @@ static inline ulong sbi_hart_expected_trap_addr(void)
 }
 
 unsigned int sbi_hart_mhpm_count(struct sbi_scratch *scratch);
+int sbi_hart_misaligned_delegation(struct sbi_scratch *scratch, bool enable);
+bool sbi_hart_misaligned_delegated(void);
 void sbi_hart_delegation_dump(struct sbi_scratch *scratch,
 			      const char *prefix, const char *suffix);
 unsigned int sbi_hart_pmp_count(struct sbi_scratch *scratch);
@@ -63,6 +63,14 @@ enum sbi_platform_features {
 #define SBI_PLATFORM_DEFAULT_FEATURES                                \
 	(SBI_PLATFORM_HAS_MFAULTS_DELEGATION)
 
+/** Cache block operations used to emulate Zicbom/Zicboz */
+enum sbi_cbo_op {
+	SBI_CBO_INVAL = 0,
+	SBI_CBO_CLEAN,
+	SBI_CBO_FLUSH,
+	SBI_CBO_ZERO,
+};
+
 /** Platform functions */
 struct sbi_platform_operations {
 	/* Platform nascent initialization */
@@ -123,6 +131,11 @@ struct sbi_platform_operations {
 	/** Exit platform timer for current HART */
 	void (*timer_exit)(void);
 
+	/** Get cache block size for Zicbom/Zicboz emulation */
+	unsigned long (*cbo_block_size)(void);
+	/** Clean, invalidate or flush a physical address range */
+	int (*cbo_op)(int op, unsigned long paddr, unsigned long size);
+
 	/** platform specific SBI extension implementation probe function */
 	int (*vendor_ext_check)(long extid);
 	/** platform specific SBI extension implementation provider */
@@ -615,6 +628,43 @@ static inline void sbi_platform_timer_exit(const struct sbi_platform *plat)
 		sbi_platform_ops(plat)->timer_exit();
 }
 
+/**
+ * Get cache block size used to emulate Zicbom/Zicboz
+ *
+ * @param plat pointer to struct sbi_platform
+ *
+ * @return cache block size in bytes or 0 if emulation is not supported
+ */
+static inline unsigned long sbi_platform_cbo_block_size(
+					const struct sbi_platform *plat)
+{
+	if (plat && sbi_platform_ops(plat)->cbo_block_size)
+		return sbi_platform_ops(plat)->cbo_block_size();
+	return 0;
+}
+
+/**
+ * Perform a cache block operation on a physical address range
+ *
+ * SBI_CBO_ZERO is emulated with ordinary stores and never reaches the
+ * platform.
+ *
+ * @param plat pointer to struct sbi_platform
+ * @param op cache block operation (enum sbi_cbo_op)
+ * @param paddr physical start address
+ * @param size size of the range in bytes
+ *
+ * @return 0 on success and negative error code on failure
+ */
+static inline int sbi_platform_cbo_op(const struct sbi_platform *plat,
+				      int op, unsigned long paddr,
+				      unsigned long size)
+{
+	if (plat && sbi_platform_ops(plat)->cbo_op)
+		return sbi_platform_ops(plat)->cbo_op(op, paddr, size);
+	return SBI_ENOTSUPP;
+}
+
 /**
  * Check if a vendor extension is implemented or not.
  *
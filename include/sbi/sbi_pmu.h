@@ -132,4 +132,62 @@ int sbi_pmu_ctr_cfg_match(unsigned long cidx_base, unsigned long cidx_mask,
 
 int sbi_pmu_ctr_incr_fw(enum sbi_pmu_fw_event_code_id fw_id);
 
+int sbi_pmu_ctr_incr_opensbi_fw(enum sbi_pmu_fw_opensbi_event_id id);
+
+/**
+ * Add a value to the started firmware counter of an OpenSBI specific
+ * event, which S-mode selects with SBI_PMU_FW_PLATFORM and event_data
+ * @param id  OpenSBI firmware event
+ * @param val Value to add
+ * @return 0 on success, error otherwise.
+ */
+int sbi_pmu_ctr_add_opensbi_fw(enum sbi_pmu_fw_opensbi_event_id id,
+			       uint64_t val);
+
+/**
+ * Record the origin of the trap being handled on current HART. The live
+ * MPV bit is not reliable for this once nested traps or trap redirection
+ * have happened, so the trap handler passes the value it saw at entry.
+ * @param virt TRUE if the trap was taken from VS or VU mode
+ */
+void sbi_pmu_set_trap_virt(bool virt);
+
+/**
+ * Read the share of a firmware counter caused by a guest on current HART
+ * @param vmid  VMID of the guest as programmed in hgatp
+ * @param cidx  Index of a counter mapped to a firmware event
+ * @param flags SBI_OPENSBI_PMU_VMID_READ_FLAG_* flags
+ * @param cval  Output value of the guest share
+ * @return 0 on success, error otherwise.
+ */
+int sbi_pmu_vmid_read(unsigned long vmid, uint32_t cidx,
+		      unsigned long flags, uint64_t *cval);
+
+/**
+ * Drop the firmware counter bank of a guest on current HART
+ * @param vmid VMID of the guest as programmed in hgatp
+ * @return 0 on success, error otherwise.
+ */
+int sbi_pmu_vmid_release(unsigned long vmid);
+
+/**
+ * Set the period of firmware event multiplexing. When non-zero, events
+ * for which no hardware counter is free get a firmware counter and are
+ * time-sliced onto the hardware counters with this period.
+ * @param usecs Rotation period in microseconds, zero disables it
+ * @return 0 on success, error otherwise.
+ */
+int sbi_pmu_set_mux_period(unsigned long usecs);
+
+/**
+ * Set the PMU snapshot shared memory of current HART
+ * @param shmem_lo Lower XLEN bits of the physical address
+ * @param shmem_hi Upper XLEN bits of the physical address
+ * @param flags    Reserved, must be zero
+ * @return 0 on success, error otherwise.
+ */
+int sbi_pmu_snapshot_set_shmem(unsigned long shmem_lo,
+			       unsigned long shmem_hi,
+			       unsigned long flags);
+
 #endif
@@ -40,6 +40,8 @@
 #define SBI_SCRATCH_EXTRA_SPACE_OFFSET		(11 * __SIZEOF_POINTER__)
 /** Maximum size of sbi_scratch (4KB) */
 #define SBI_SCRATCH_SIZE			(0x1000)
+/** Cache line size assumed for per-HART data in sbi_scratch */
+#define SBI_SCRATCH_CACHE_LINE_SIZE		(64)
 
 /* clang-format on */
 
@@ -160,6 +162,19 @@ int sbi_scratch_init(struct sbi_scratch *scratch);
  */
 unsigned long sbi_scratch_alloc_offset(unsigned long size);
 
+/**
+ * Allocate from extra space in sbi_scratch with the start and the size of
+ * the allocation aligned to a power of two
+ *
+ * Allocations aligned to SBI_SCRATCH_CACHE_LINE_SIZE don't share cache
+ * lines with other data of the same HART.
+ *
+ * @return zero on failure and non-zero (>= SBI_SCRATCH_EXTRA_SPACE_OFFSET)
+ * on success
+ */
+unsigned long sbi_scratch_alloc_aligned_offset(unsigned long size,
+					       unsigned long align);
+
 /** Free-up extra space in sbi_scratch */
 void sbi_scratch_free_offset(unsigned long offset);
 
@@ -30,6 +30,27 @@ struct sbi_timer_device {
 	void (*timer_event_stop)(void);
 };
 
+/** Firmware timer event */
+struct sbi_timer_event {
+	/** Absolute deadline in timer ticks */
+	u64 time;
+
+	/** Called on the owning HART once the deadline has passed */
+	void (*handler)(struct sbi_timer_event *ev);
+
+	/** Private data of the event owner */
+	void *priv;
+
+	/** Position in the HART timer queue plus one, zero if not queued */
+	u32 index;
+
+	/** SBI_TIMER_EVENT_* flags, not to be changed while queued */
+	u32 flags;
+};
+
+/** Fire at the deadline, never deferred by the timer slack */
+#define SBI_TIMER_EVENT_EXACT		(1U << 0)
+
 struct sbi_scratch;
 
 /** Generic delay loop of desired granularity */
@@ -81,9 +102,51 @@ void sbi_timer_set_delta(ulong delta);
 /** Set upper 32-bits of timer delta value for current HART */
 void sbi_timer_set_delta_upper(ulong delta_upper);
 
+/**
+ * Set the timer slack of all HARTs
+ *
+ * Timer events may fire up to @p usecs late, which lets the firmware
+ * skip reprogramming the timer device and handle close deadlines with
+ * a single timer interrupt.
+ *
+ * @param usecs the slack in microseconds, zero for exact deadlines
+ *
+ * @return 0 on success and negative error code on failure
+ */
+int sbi_timer_set_slack(ulong usecs);
+
+/** Get the timer slack in microseconds */
+ulong sbi_timer_get_slack(void);
+
+/** Get the last timer event programmed for current HART */
+u64 sbi_timer_get_cmp(void);
+
 /** Start timer event for current HART */
 void sbi_timer_event_start(u64 next_event);
 
+/**
+ * Queue a firmware timer event on current HART
+ *
+ * The event stays owned by current HART until its handler runs or it is
+ * removed with sbi_timer_event_del(). Adding an already queued event
+ * just moves its deadline.
+ *
+ * @param ev the event to queue
+ * @param time absolute deadline in timer ticks
+ *
+ * @return 0 on success and negative error code on failure
+ */
+int sbi_timer_event_add(struct sbi_timer_event *ev, u64 time);
+
+/** Remove a firmware timer event from current HART */
+void sbi_timer_event_del(struct sbi_timer_event *ev);
+
+/** Check whether a firmware timer event is queued */
+static inline bool sbi_timer_event_pending(const struct sbi_timer_event *ev)
+{
+	return ev->index ? true : false;
+}
+
 /** Process timer event for current HART */
 void sbi_timer_process(void);
 
@@ -36,6 +36,33 @@ DECLARE_UNPRIVILEGED_LOAD_FUNCTION(u64)
 DECLARE_UNPRIVILEGED_STORE_FUNCTION(u64)
 DECLARE_UNPRIVILEGED_LOAD_FUNCTION(ulong)
 
+/**
+ * Copy memory from the address space of the lower privilege mode
+ *
+ * On failure, trap->cause is non-zero and trap describes the fault.
+ * The destination may have been partially written in that case.
+ */
+void sbi_unpriv_copy_from(void *dst, const void *src, ulong len,
+			  struct sbi_trap_info *trap);
+
+/**
+ * Copy memory to the address space of the lower privilege mode
+ *
+ * On failure, trap->cause is non-zero and trap describes the fault.
+ * The destination may have been partially written in that case.
+ */
+void sbi_unpriv_copy_to(void *dst, const void *src, ulong len,
+			struct sbi_trap_info *trap);
+
+/**
+ * Load a word from a physical address in M-mode
+ *
+ * Used for memory chosen by a lower privilege mode, such as its page
+ * tables. On failure, trap->cause is non-zero, trap describes the fault
+ * and zero is returned.
+ */
+ulong sbi_load_guarded_ulong(const ulong *addr, struct sbi_trap_info *trap);
+
 ulong sbi_get_insn(ulong mepc, struct sbi_trap_info *trap);
 
 #endif
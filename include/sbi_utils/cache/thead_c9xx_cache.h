@@ -0,0 +1,57 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Cache maintenance helpers shared by the T-HEAD C9xx based platforms.
+ */
+
+#ifndef __CACHE_THEAD_C9XX_CACHE_H__
+#define __CACHE_THEAD_C9XX_CACHE_H__
+
+#include <sbi/sbi_types.h>
+
+#ifndef THEAD_C9XX_CSR_MCOR
+#define THEAD_C9XX_CSR_MCOR		0x7c2
+#endif
+
+/* T-HEAD C9xx MCOR CSR fields */
+#define THEAD_C9XX_MCOR_ICACHE		(_UL(1) << 0)
+#define THEAD_C9XX_MCOR_DCACHE		(_UL(1) << 1)
+#define THEAD_C9XX_MCOR_INV		(_UL(1) << 4)
+#define THEAD_C9XX_MCOR_CLR		(_UL(1) << 5)
+
+/* T-HEAD C9xx cache operations, the address is passed in a0 */
+#define THEAD_C9XX_CACHE_LINE_SIZE	64
+#define THEAD_C9XX_DCACHE_CPA_A0	".long 0x0295000b"
+#define THEAD_C9XX_DCACHE_IPA_A0	".long 0x02a5000b"
+#define THEAD_C9XX_DCACHE_CIPA_A0	".long 0x02b5000b"
+#define THEAD_C9XX_SYNC_S		".long 0x0190000b"
+
+/**
+ * Clean, invalidate or flush the data cache lines covering a physical
+ * address range and wait for completion on all harts.
+ *
+ * @param op    SBI_CBO_INVAL, SBI_CBO_CLEAN or SBI_CBO_FLUSH
+ * @param paddr physical start address
+ * @param size  size of the range in bytes
+ *
+ * @return 0 on success and negative error code on failure
+ */
+int thead_c9xx_cbo_op(int op, unsigned long paddr, unsigned long size);
+
+/**
+ * Clean, invalidate or flush a physical address range on behalf of the
+ * supervisor after checking it against the domain of the calling hart.
+ *
+ * @param paddr physical start address
+ * @param size  size of the range in bytes
+ * @param op    SBI_CBO_INVAL, SBI_CBO_CLEAN or SBI_CBO_FLUSH
+ * @param whole size from which clean and flush operate on the whole
+ *              data cache on single hart systems, 0 to always walk
+ *              the range
+ *
+ * @return 0 on success and negative error code on failure
+ */
+int thead_c9xx_cache_range(unsigned long paddr, unsigned long size,
+			   unsigned long op, unsigned long whole);
+
+#endif
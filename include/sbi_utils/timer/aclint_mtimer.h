@@ -10,6 +10,8 @@
 #ifndef __TIMER_ACLINT_MTIMER_H__
 #define __TIMER_ACLINT_MTIMER_H__
 
+#include <sbi/riscv_atomic.h>
+#include <sbi/sbi_timer.h>
 #include <sbi/sbi_types.h>
 
 #define ACLINT_MTIMER_ALIGN		0x8
@@ -35,9 +37,14 @@ struct aclint_mtimer_data {
 	u32 hart_count;
 	bool has_64bit_mmio;
 	bool has_shared_mtime;
+	unsigned long resync_period_ms;
 	/* Private details (initialized and used by ACLINT MTIMER library) */
 	struct aclint_mtimer_data *time_delta_reference;
 	unsigned long time_delta_computed;
+	s64 time_delta_skew;
+	u64 time_delta_rtt;
+	atomic_t resync_owner;
+	struct sbi_timer_event resync_event;
 	u64 (*time_rd)(volatile u64 *addr);
 	void (*time_wr)(bool timecmp, u64 value, volatile u64 *addr);
 };
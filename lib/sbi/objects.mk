@@ -37,17 +37,27 @@ libsbi-objs-$(CONFIG_SBI_ECALL_SRST) += sbi_ecall_srst.o
 carray-sbi_ecall_exts-$(CONFIG_SBI_ECALL_PMU) += ecall_pmu
 libsbi-objs-$(CONFIG_SBI_ECALL_PMU) += sbi_ecall_pmu.o
 
+carray-sbi_ecall_exts-$(CONFIG_SBI_ECALL_PMU_VMID) += ecall_pmu_vmid
+libsbi-objs-$(CONFIG_SBI_ECALL_PMU_VMID) += sbi_ecall_pmu_vmid.o
+
 carray-sbi_ecall_exts-$(CONFIG_SBI_ECALL_LEGACY) += ecall_legacy
 libsbi-objs-$(CONFIG_SBI_ECALL_LEGACY) += sbi_ecall_legacy.o
 
 carray-sbi_ecall_exts-$(CONFIG_SBI_ECALL_VENDOR) += ecall_vendor
 libsbi-objs-$(CONFIG_SBI_ECALL_VENDOR) += sbi_ecall_vendor.o
 
+carray-sbi_ecall_exts-$(CONFIG_SBI_ECALL_BATCH) += ecall_batch
+libsbi-objs-$(CONFIG_SBI_ECALL_BATCH) += sbi_ecall_batch.o
+
+carray-sbi_ecall_exts-$(CONFIG_SBI_ECALL_FEATURE) += ecall_feature
+libsbi-objs-$(CONFIG_SBI_ECALL_FEATURE) += sbi_ecall_feature.o
+
 libsbi-objs-y += sbi_bitmap.o
 libsbi-objs-y += sbi_bitops.o
 libsbi-objs-y += sbi_console.o
 libsbi-objs-y += sbi_domain.o
 libsbi-objs-y += sbi_emulate_csr.o
+libsbi-objs-y += sbi_extable.o
 libsbi-objs-y += sbi_fifo.o
 libsbi-objs-y += sbi_hart.o
 libsbi-objs-y += sbi_math.o
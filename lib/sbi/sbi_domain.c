@@ -140,6 +140,52 @@ bool sbi_domain_check_addr(const struct sbi_domain *dom,
 	return (mode == PRV_M) ? TRUE : FALSE;
 }
 
+bool sbi_domain_check_addr_range(const struct sbi_domain *dom,
+				 unsigned long addr, unsigned long size,
+				 unsigned long mode,
+				 unsigned long access_flags)
+{
+	struct sbi_domain_memregion *reg;
+	unsigned long rstart, rend, next, max = addr + size;
+
+	if (!dom || max < addr)
+		return FALSE;
+
+	while (addr < max) {
+		if (!sbi_domain_check_addr(dom, addr, mode, access_flags))
+			return FALSE;
+
+		/*
+		 * The first region containing addr decides the permissions
+		 * until either that region ends or an earlier region starts.
+		 */
+		next = 0;
+		sbi_domain_for_each_memregion(dom, reg) {
+			if (mode == PRV_M &&
+			    !(reg->flags & SBI_DOMAIN_MEMREGION_MMODE))
+				continue;
+
+			rstart = reg->base;
+			rend = (reg->order < __riscv_xlen) ?
+				rstart + ((1UL << reg->order) - 1) : -1UL;
+			if (rstart <= addr && addr <= rend) {
+				if (!next || rend + 1 < next)
+					next = rend + 1;
+				break;
+			}
+			if (addr < rstart && (!next || rstart < next))
+				next = rstart;
+		}
+
+		/* Nothing changes up to the end of the address space */
+		if (!next)
+			break;
+		addr = next;
+	}
+
+	return TRUE;
+}
+
 /* Check if region complies with constraints */
 static bool is_region_valid(const struct sbi_domain_memregion *reg)
 {
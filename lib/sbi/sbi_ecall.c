@@ -152,6 +152,11 @@ int sbi_ecall_init(void)
 
 	for (i = 0; i < sbi_ecall_exts_size; i++) {
 		ext = sbi_ecall_exts[i];
+		if (ext->init) {
+			ret = ext->init();
+			if (ret)
+				return ret;
+		}
 		ret = sbi_ecall_register_extension(ext);
 		if (ret)
 			return ret;
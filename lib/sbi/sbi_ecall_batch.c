@@ -0,0 +1,254 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Batched SBI call submission through per-HART shared memory.
+ *
+ * The supervisor registers a ring of request descriptors per HART and
+ * queues any number of SBI calls into it. A single DOORBELL ecall then
+ * makes OpenSBI drain the ring, dispatch every request to the regular
+ * extension handler and write the results back into the descriptors.
+ */
+
+#include <sbi/riscv_asm.h>
+#include <sbi/riscv_barrier.h>
+#include <sbi/sbi_domain.h>
+#include <sbi/sbi_ecall.h>
+#include <sbi/sbi_ecall_interface.h>
+#include <sbi/sbi_error.h>
+#include <sbi/sbi_scratch.h>
+#include <sbi/sbi_string.h>
+#include <sbi/sbi_trap.h>
+
+/* Maximum number of descriptors in a per-HART ring */
+#define SBI_BATCH_MAX_ENTRIES		256
+
+/**
+ * Layout of one request descriptor in shared memory
+ *
+ * The supervisor fills extid, funcid and args before advancing the
+ * ring tail. OpenSBI fills error and value before advancing the ring
+ * head, so both fields are valid for every slot behind the head.
+ */
+struct sbi_batch_entry {
+	unsigned long extid;
+	unsigned long funcid;
+	unsigned long args[6];
+	long error;
+	unsigned long value;
+};
+
+/**
+ * Layout of the per-HART shared memory
+ *
+ * head and tail are free running indexes, the slot used by an index
+ * is (index % nr_entries). The supervisor only writes tail whereas
+ * OpenSBI only writes head.
+ */
+struct sbi_batch_shmem {
+	unsigned long head;
+	unsigned long tail;
+	struct sbi_batch_entry entries[];
+};
+
+struct sbi_batch_hart_state {
+	struct sbi_batch_shmem *shmem;
+	unsigned long nr_entries;
+};
+
+static unsigned long batch_state_offset;
+
+static struct sbi_batch_hart_state *sbi_batch_thishart_state(void)
+{
+	if (!batch_state_offset)
+		return NULL;
+
+	return sbi_scratch_thishart_offset_ptr(batch_state_offset);
+}
+
+static int sbi_batch_set_shmem(unsigned long addr_lo, unsigned long addr_hi,
+			       unsigned long nr_entries)
+{
+	unsigned long size;
+	struct sbi_batch_hart_state *bs = sbi_batch_thishart_state();
+
+	if (!bs)
+		return SBI_EFAIL;
+
+	/* Zero entries disables batching on this HART */
+	if (!nr_entries) {
+		bs->shmem = NULL;
+		bs->nr_entries = 0;
+		return 0;
+	}
+
+	if (addr_hi)
+		return SBI_EINVALID_ADDR;
+	if (addr_lo & (__SIZEOF_POINTER__ - 1))
+		return SBI_EINVALID_ADDR;
+	if ((nr_entries > SBI_BATCH_MAX_ENTRIES) ||
+	    (nr_entries & (nr_entries - 1)))
+		return SBI_EINVAL;
+
+	size = sizeof(struct sbi_batch_shmem) +
+	       nr_entries * sizeof(struct sbi_batch_entry);
+	if (addr_lo + size < addr_lo)
+		return SBI_EINVALID_ADDR;
+
+	if (!sbi_domain_check_addr_range(sbi_domain_thishart_ptr(), addr_lo,
+					 size, PRV_S,
+					 SBI_DOMAIN_READ | SBI_DOMAIN_WRITE))
+		return SBI_EINVALID_ADDR;
+
+	bs->shmem = (struct sbi_batch_shmem *)addr_lo;
+	bs->nr_entries = nr_entries;
+
+	return 0;
+}
+
+/*
+ * A call which may not return to the caller, such as HART stop or
+ * system reset, would leave the ring head behind. The descriptor would
+ * then be dispatched again once the HART runs the next doorbell.
+ */
+static bool sbi_batch_call_returns(unsigned long extid, unsigned long funcid)
+{
+	switch (extid) {
+	case SBI_EXT_HSM:
+		return (funcid != SBI_EXT_HSM_HART_STOP &&
+			funcid != SBI_EXT_HSM_HART_SUSPEND) ? TRUE : FALSE;
+	case SBI_EXT_SRST:
+		return FALSE;
+	default:
+		return TRUE;
+	}
+}
+
+static void sbi_batch_do_entry(const struct sbi_trap_regs *regs,
+			       struct sbi_batch_entry *ent)
+{
+	int ret;
+	unsigned long out_val = 0;
+	struct sbi_batch_entry req;
+	struct sbi_trap_regs bregs = *regs;
+	struct sbi_trap_info trap = {0};
+	struct sbi_ecall_extension *ext;
+
+	/*
+	 * The descriptor stays writable by other HARTs, so validate and
+	 * dispatch only from a private copy of it.
+	 */
+	sbi_memcpy(&req, ent, sizeof(req));
+
+	/*
+	 * Legacy extensions have a different return convention and
+	 * nesting batches makes no sense so reject both, along with
+	 * calls which may not return.
+	 */
+	if (req.extid <= SBI_EXT_0_1_SHUTDOWN ||
+	    req.extid == SBI_EXT_OPENSBI_BATCH ||
+	    !sbi_batch_call_returns(req.extid, req.funcid)) {
+		ent->error = SBI_ERR_NOT_SUPPORTED;
+		ent->value = 0;
+		return;
+	}
+
+	ext = sbi_ecall_find_extension(req.extid);
+	if (!ext || !ext->handle) {
+		ent->error = SBI_ERR_NOT_SUPPORTED;
+		ent->value = 0;
+		return;
+	}
+
+	bregs.a0 = req.args[0];
+	bregs.a1 = req.args[1];
+	bregs.a2 = req.args[2];
+	bregs.a3 = req.args[3];
+	bregs.a4 = req.args[4];
+	bregs.a5 = req.args[5];
+	bregs.a6 = req.funcid;
+	bregs.a7 = req.extid;
+
+	ret = ext->handle(req.extid, req.funcid, &bregs, &out_val, &trap);
+	if (ret == SBI_ETRAP)
+		ret = SBI_ERR_INVALID_ADDRESS;
+	else if (ret < SBI_LAST_ERR)
+		ret = SBI_ERR_FAILED;
+
+	ent->value = out_val;
+	ent->error = ret;
+}
+
+static int sbi_batch_doorbell(const struct sbi_trap_regs *regs,
+			      unsigned long *out_val)
+{
+	unsigned long head, tail, count = 0;
+	struct sbi_batch_shmem *shmem;
+	struct sbi_batch_hart_state *bs = sbi_batch_thishart_state();
+
+	if (!bs)
+		return SBI_EFAIL;
+	if (!bs->shmem)
+		return SBI_EDENIED;
+
+	shmem = bs->shmem;
+	head = shmem->head;
+	tail = shmem->tail;
+	if ((tail - head) > bs->nr_entries)
+		return SBI_EINVAL;
+
+	/* Read descriptors only after observing the new tail */
+	smp_rmb();
+
+	while (head != tail) {
+		sbi_batch_do_entry(regs,
+			&shmem->entries[head & (bs->nr_entries - 1)]);
+		head++;
+		count++;
+
+		/* Publish results before handing the slot back */
+		smp_wmb();
+		shmem->head = head;
+	}
+
+	*out_val = count;
+
+	return 0;
+}
+
+static int sbi_ecall_batch_handler(unsigned long extid, unsigned long funcid,
+				   const struct sbi_trap_regs *regs,
+				   unsigned long *out_val,
+				   struct sbi_trap_info *out_trap)
+{
+	int ret;
+
+	switch (funcid) {
+	case SBI_EXT_OPENSBI_BATCH_SET_SHMEM:
+		ret = sbi_batch_set_shmem(regs->a0, regs->a1, regs->a2);
+		break;
+	case SBI_EXT_OPENSBI_BATCH_DOORBELL:
+		ret = sbi_batch_doorbell(regs, out_val);
+		break;
+	default:
+		ret = SBI_ENOTSUPP;
+	}
+
+	return ret;
+}
+
+static int sbi_ecall_batch_init(void)
+{
+	batch_state_offset = sbi_scratch_alloc_offset(
+				sizeof(struct sbi_batch_hart_state));
+	if (!batch_state_offset)
+		return SBI_ENOMEM;
+
+	return 0;
+}
+
+struct sbi_ecall_extension ecall_batch = {
+	.extid_start = SBI_EXT_OPENSBI_BATCH,
+	.extid_end = SBI_EXT_OPENSBI_BATCH,
+	.init = sbi_ecall_batch_init,
+	.handle = sbi_ecall_batch_handler,
+};
@@ -0,0 +1,75 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Firmware feature toggles which the supervisor can change at runtime.
+ */
+
+#include <sbi/sbi_domain.h>
+#include <sbi/sbi_ecall.h>
+#include <sbi/sbi_ecall_interface.h>
+#include <sbi/sbi_error.h>
+#include <sbi/sbi_hart.h>
+#include <sbi/sbi_scratch.h>
+#include <sbi/sbi_timer.h>
+#include <sbi/sbi_trap.h>
+
+static int sbi_feature_set(unsigned long feature, unsigned long value)
+{
+	struct sbi_scratch *scratch = sbi_scratch_thishart_ptr();
+
+	switch (feature) {
+	case SBI_OPENSBI_FEATURE_MISALIGNED_DELEG:
+		if (value > 1)
+			return SBI_EINVAL;
+		return sbi_hart_misaligned_delegation(scratch,
+						      value ? TRUE : FALSE);
+	case SBI_OPENSBI_FEATURE_TIMER_SLACK:
+		/* The slack applies to all HARTs, so only root may change it */
+		if (sbi_domain_thishart_ptr() != &root)
+			return SBI_EDENIED;
+		return sbi_timer_set_slack(value);
+	default:
+		return SBI_ENOTSUPP;
+	}
+}
+
+static int sbi_feature_get(unsigned long feature, unsigned long *out_val)
+{
+	switch (feature) {
+	case SBI_OPENSBI_FEATURE_MISALIGNED_DELEG:
+		*out_val = sbi_hart_misaligned_delegated() ? 1 : 0;
+		return 0;
+	case SBI_OPENSBI_FEATURE_TIMER_SLACK:
+		*out_val = sbi_timer_get_slack();
+		return 0;
+	default:
+		return SBI_ENOTSUPP;
+	}
+}
+
+static int sbi_ecall_feature_handler(unsigned long extid, unsigned long funcid,
+				     const struct sbi_trap_regs *regs,
+				     unsigned long *out_val,
+				     struct sbi_trap_info *out_trap)
+{
+	int ret;
+
+	switch (funcid) {
+	case SBI_EXT_OPENSBI_FEATURE_SET:
+		ret = sbi_feature_set(regs->a0, regs->a1);
+		break;
+	case SBI_EXT_OPENSBI_FEATURE_GET:
+		ret = sbi_feature_get(regs->a0, out_val);
+		break;
+	default:
+		ret = SBI_ENOTSUPP;
+	}
+
+	return ret;
+}
+
+struct sbi_ecall_extension ecall_feature = {
+	.extid_start = SBI_EXT_OPENSBI_FEATURE,
+	.extid_end = SBI_EXT_OPENSBI_FEATURE,
+	.handle = sbi_ecall_feature_handler,
+};
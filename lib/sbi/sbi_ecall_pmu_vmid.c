@@ -0,0 +1,66 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Per-guest share of the firmware PMU counters, read by the hypervisor.
+ */
+
+#include <sbi/sbi_ecall.h>
+#include <sbi/sbi_ecall_interface.h>
+#include <sbi/sbi_error.h>
+#include <sbi/sbi_hart.h>
+#include <sbi/sbi_pmu.h>
+#include <sbi/sbi_trap.h>
+#include <sbi/riscv_asm.h>
+
+static int sbi_ecall_pmu_vmid_handler(unsigned long extid,
+				      unsigned long funcid,
+				      const struct sbi_trap_regs *regs,
+				      unsigned long *out_val,
+				      struct sbi_trap_info *out_trap)
+{
+	int ret;
+	uint64_t temp;
+#if __riscv_xlen == 32
+	bool prev_virt = (regs->mstatusH & MSTATUSH_MPV) ? TRUE : FALSE;
+#else
+	bool prev_virt = (regs->mstatus & MSTATUS_MPV) ? TRUE : FALSE;
+#endif
+
+	/* Guests must not look at the banks of each other */
+	if (prev_virt)
+		return SBI_EDENIED;
+
+	switch (funcid) {
+	case SBI_EXT_OPENSBI_PMU_VMID_READ:
+		/* Counter indices are 32 bits wide */
+		if (regs->a1 != (uint32_t)regs->a1) {
+			ret = SBI_EINVAL;
+			break;
+		}
+		ret = sbi_pmu_vmid_read(regs->a0, regs->a1, regs->a2, &temp);
+		*out_val = temp;
+		break;
+	case SBI_EXT_OPENSBI_PMU_VMID_RELEASE:
+		ret = sbi_pmu_vmid_release(regs->a0);
+		break;
+	default:
+		ret = SBI_ENOTSUPP;
+	}
+
+	return ret;
+}
+
+static int sbi_ecall_pmu_vmid_probe(unsigned long extid,
+				    unsigned long *out_val)
+{
+	/* Guests only exist when the hypervisor extension is present */
+	*out_val = misa_extension('H') ? 1 : 0;
+	return 0;
+}
+
+struct sbi_ecall_extension ecall_pmu_vmid = {
+	.extid_start = SBI_EXT_OPENSBI_PMU_VMID,
+	.extid_end = SBI_EXT_OPENSBI_PMU_VMID,
+	.handle = sbi_ecall_pmu_vmid_handler,
+	.probe = sbi_ecall_pmu_vmid_probe,
+};
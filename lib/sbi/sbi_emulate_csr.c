@@ -61,6 +61,16 @@ int sbi_emulate_csr_read(int csr_num, struct sbi_trap_regs *regs,
 		else
 			ret = SBI_ENOTSUPP;
 		break;
+	case CSR_STIMECMP:
+		/*
+		 * Harts without Sstc get stimecmp emulated on top of the
+		 * platform timer so Sstc-only kernels keep working.
+		 */
+		if (prev_mode == PRV_S && !virt)
+			*csr_val = sbi_timer_get_cmp();
+		else
+			ret = SBI_ENOTSUPP;
+		break;
 	case CSR_CYCLE:
 		if (!hpm_allowed(csr_num - CSR_CYCLE, prev_mode, virt))
 			return SBI_ENOTSUPP;
@@ -90,6 +100,12 @@ int sbi_emulate_csr_read(int csr_num, struct sbi_trap_regs *regs,
 		else
 			ret = SBI_ENOTSUPP;
 		break;
+	case CSR_STIMECMPH:
+		if (prev_mode == PRV_S && !virt)
+			*csr_val = sbi_timer_get_cmp() >> 32;
+		else
+			ret = SBI_ENOTSUPP;
+		break;
 	case CSR_CYCLEH:
 		if (!hpm_allowed(csr_num - CSR_CYCLEH, prev_mode, virt))
 			return SBI_ENOTSUPP;
@@ -176,6 +192,18 @@ int sbi_emulate_csr_write(int csr_num, struct sbi_trap_regs *regs,
 		else
 			ret = SBI_ENOTSUPP;
 		break;
+	case CSR_STIMECMP:
+		/* Refer comments on STIMECMP in sbi_emulate_csr_read() */
+		if (prev_mode == PRV_S && !virt)
+#if __riscv_xlen == 32
+			sbi_timer_event_start((sbi_timer_get_cmp() &
+					       ~0xffffffffULL) | csr_val);
+#else
+			sbi_timer_event_start(csr_val);
+#endif
+		else
+			ret = SBI_ENOTSUPP;
+		break;
 #if __riscv_xlen == 32
 	case CSR_HTIMEDELTAH:
 		if (prev_mode == PRV_S && !virt)
@@ -183,6 +211,14 @@ int sbi_emulate_csr_write(int csr_num, struct sbi_trap_regs *regs,
 		else
 			ret = SBI_ENOTSUPP;
 		break;
+	case CSR_STIMECMPH:
+		if (prev_mode == PRV_S && !virt)
+			sbi_timer_event_start((sbi_timer_get_cmp() &
+					       0xffffffffULL) |
+					      ((u64)csr_val << 32));
+		else
+			ret = SBI_ENOTSUPP;
+		break;
 #endif
 	default:
 		ret = SBI_ENOTSUPP;
@@ -0,0 +1,63 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Exception table for M-mode accesses which are expected to fault.
+ */
+
+#include <sbi/sbi_error.h>
+#include <sbi/sbi_extable.h>
+#include <sbi/sbi_trap.h>
+
+extern struct sbi_extable_entry __sbi_extable_start[];
+extern struct sbi_extable_entry __sbi_extable_end[];
+
+void sbi_extable_init(void)
+{
+	struct sbi_extable_entry tmp, *i, *j;
+
+	/*
+	 * Entries are emitted in code order of each object file but the
+	 * linker is free to place sections and functions as it likes so
+	 * sort the table once. It is small hence insertion sort is good
+	 * enough.
+	 */
+	for (i = __sbi_extable_start + 1; i < __sbi_extable_end; i++) {
+		tmp = *i;
+		for (j = i; j > __sbi_extable_start &&
+			    (j - 1)->insn > tmp.insn; j--)
+			*j = *(j - 1);
+		*j = tmp;
+	}
+}
+
+const struct sbi_extable_entry *sbi_extable_search(unsigned long addr)
+{
+	unsigned long lo = 0, hi = __sbi_extable_end - __sbi_extable_start;
+	unsigned long mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (__sbi_extable_start[mid].insn < addr)
+			lo = mid + 1;
+		else if (__sbi_extable_start[mid].insn > addr)
+			hi = mid;
+		else
+			return &__sbi_extable_start[mid];
+	}
+
+	return NULL;
+}
+
+int sbi_extable_fixup(struct sbi_trap_regs *regs,
+		      const struct sbi_trap_info *trap)
+{
+	const struct sbi_extable_entry *ent = sbi_extable_search(regs->mepc);
+
+	if (!ent)
+		return SBI_ENOENT;
+
+	*((struct sbi_trap_info *)regs->a3) = *trap;
+	regs->mepc = ent->fixup;
+
+	return 0;
+}
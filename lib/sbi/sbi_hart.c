@@ -30,6 +30,7 @@ extern void __sbi_expected_trap_hext(void);
 void (*sbi_hart_expected_trap)(void) = &__sbi_expected_trap;
 
 static unsigned long hart_features_offset;
+static unsigned long hart_deleg_offset;
 
 static void mstatus_init(struct sbi_scratch *scratch)
 {
@@ -224,12 +225,52 @@ static int delegate_traps(struct sbi_scratch *scratch)
 		exceptions |= (1U << CAUSE_STORE_GUEST_PAGE_FAULT);
 	}
 
+	/* Exceptions which S-mode asked to handle itself */
+	exceptions |= *(unsigned long *)sbi_scratch_offset_ptr(scratch,
+							 hart_deleg_offset);
+
 	csr_write(CSR_MIDELEG, interrupts);
 	csr_write(CSR_MEDELEG, exceptions);
 
 	return 0;
 }
 
+int sbi_hart_misaligned_delegation(struct sbi_scratch *scratch, bool enable)
+{
+	unsigned long *deleg;
+	unsigned long bits = (1U << CAUSE_MISALIGNED_LOAD) |
+			     (1U << CAUSE_MISALIGNED_STORE);
+
+	if (!misa_extension('S'))
+		return SBI_ENOTSUPP;
+
+	deleg = sbi_scratch_offset_ptr(scratch, hart_deleg_offset);
+	if (!enable) {
+		*deleg &= ~bits;
+		csr_clear(CSR_MEDELEG, bits);
+		return 0;
+	}
+
+	/* MEDELEG is WARL so check that both causes can be delegated */
+	csr_set(CSR_MEDELEG, bits);
+	if ((csr_read(CSR_MEDELEG) & bits) != bits) {
+		csr_clear(CSR_MEDELEG, bits);
+		return SBI_ENOTSUPP;
+	}
+	*deleg |= bits;
+
+	return 0;
+}
+
+bool sbi_hart_misaligned_delegated(void)
+{
+	if (!misa_extension('S'))
+		return FALSE;
+
+	return (csr_read(CSR_MEDELEG) & (1U << CAUSE_MISALIGNED_LOAD)) ?
+		TRUE : FALSE;
+}
+
 void sbi_hart_delegation_dump(struct sbi_scratch *scratch,
 			      const char *prefix, const char *suffix)
 {
@@ -725,6 +766,7 @@ int sbi_hart_reinit(struct sbi_scratch *scratch)
 int sbi_hart_init(struct sbi_scratch *scratch, bool cold_boot)
 {
 	int rc;
+	unsigned long *deleg;
 
 	if (cold_boot) {
 		if (misa_extension('H'))
@@ -734,8 +776,25 @@ int sbi_hart_init(struct sbi_scratch *scratch, bool cold_boot)
 					sizeof(struct sbi_hart_features));
 		if (!hart_features_offset)
 			return SBI_ENOMEM;
+
+		hart_deleg_offset = sbi_scratch_alloc_offset(
+					sizeof(unsigned long));
+		if (!hart_deleg_offset)
+			return SBI_ENOMEM;
 	}
 
+	/*
+	 * Delegation requested by S-mode does not survive a HART stop
+	 * or reset so go back to the build time default. It is only
+	 * kept across suspend via sbi_hart_reinit().
+	 */
+	deleg = sbi_scratch_offset_ptr(scratch, hart_deleg_offset);
+	*deleg = 0;
+#ifdef CONFIG_SBI_MISALIGNED_DELEG_DEFAULT
+	*deleg |= (1U << CAUSE_MISALIGNED_LOAD) |
+		  (1U << CAUSE_MISALIGNED_STORE);
+#endif
+
 	rc = hart_detect_features(scratch);
 	if (rc)
 		return rc;
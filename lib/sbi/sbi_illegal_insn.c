@@ -11,9 +11,11 @@
 #include <sbi/riscv_barrier.h>
 #include <sbi/riscv_encoding.h>
 #include <sbi/sbi_bitops.h>
+#include <sbi/sbi_domain.h>
 #include <sbi/sbi_emulate_csr.h>
 #include <sbi/sbi_error.h>
 #include <sbi/sbi_illegal_insn.h>
+#include <sbi/sbi_platform.h>
 #include <sbi/sbi_pmu.h>
 #include <sbi/sbi_trap.h>
 #include <sbi/sbi_unpriv.h>
@@ -35,6 +37,303 @@ static int truly_illegal_insn(ulong insn, struct sbi_trap_regs *regs)
 	return sbi_trap_redirect(regs, &trap);
 }
 
+/* Maximum number of cache blocks handled by one trapped CBO loop */
+#define CBO_BATCH_MAX			1024
+
+#define CBO_PTE_V			_UL(0x1)
+#define CBO_PTE_R			_UL(0x2)
+#define CBO_PTE_X			_UL(0x8)
+#define CBO_PTE_PPN_SHIFT		10
+#define CBO_PTE_PPN_MASK		_ULL(0xFFFFFFFFFFF)
+#define CBO_PTE_N			_ULL(0x8000000000000000)
+
+/*
+ * Walk the S-mode page table to find the physical address backing
+ * vaddr. The caller has already probed vaddr with an unprivileged load
+ * so leaf permission checks are not needed here. The page table is
+ * under S-mode control, so every PTE is read like the hardware walker
+ * would: only from memory the domain lets S-mode read, and through a
+ * guarded load. Returns SBI_EDENIED if a PTE can't be read and
+ * SBI_EINVALID_ADDR if the walk finds no valid leaf.
+ */
+static int cbo_walk(ulong vaddr, ulong *paddr)
+{
+#if __riscv_xlen == 64
+	const struct sbi_domain *dom = sbi_domain_thishart_ptr();
+	ulong satp = csr_read(CSR_SATP);
+	ulong mode = (satp & SATP64_MODE) >> 60;
+	ulong ppn = satp & SATP64_PPN;
+	struct sbi_trap_info trap;
+	ulong mask, pte_addr;
+	u64 pte;
+	int level;
+
+	if (mode == SATP_MODE_OFF) {
+		*paddr = vaddr;
+		return 0;
+	}
+	if (mode < SATP_MODE_SV39 || SATP_MODE_SV57 < mode)
+		return SBI_ENOTSUPP;
+
+	for (level = mode - SATP_MODE_SV39 + 2; level >= 0; level--) {
+		pte_addr = (ppn << PAGE_SHIFT) +
+			   ((vaddr >> (PAGE_SHIFT + 9 * level)) & 0x1ff) *
+			   sizeof(pte);
+		if (!sbi_domain_check_addr_range(dom, pte_addr, sizeof(pte),
+						 PRV_S, SBI_DOMAIN_READ))
+			return SBI_EDENIED;
+		pte = sbi_load_guarded_ulong((const ulong *)pte_addr, &trap);
+		if (trap.cause)
+			return SBI_EDENIED;
+		if (!(pte & CBO_PTE_V))
+			return SBI_EINVALID_ADDR;
+
+		ppn = (pte >> CBO_PTE_PPN_SHIFT) & CBO_PTE_PPN_MASK;
+		if (!(pte & (CBO_PTE_R | CBO_PTE_X)))
+			continue;
+
+		/* Svnapot 64KiB mappings take the low PPN bits from vaddr */
+		if (pte & CBO_PTE_N)
+			ppn = (ppn & ~0xfUL) | ((vaddr >> PAGE_SHIFT) & 0xf);
+
+		mask = (1UL << (PAGE_SHIFT + 9 * level)) - 1;
+		*paddr = ((ppn << PAGE_SHIFT) & ~mask) | (vaddr & mask);
+		return 0;
+	}
+
+	return SBI_EINVALID_ADDR;
+#else
+	if (csr_read(CSR_SATP) & SATP32_MODE)
+		return SBI_ENOTSUPP;
+
+	*paddr = vaddr;
+	return 0;
+#endif
+}
+
+static int cbo_translate(ulong vaddr, ulong *paddr,
+			 struct sbi_trap_regs *regs,
+			 struct sbi_trap_info *uptrap)
+{
+	ulong prev_mode = (regs->mstatus & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT;
+	int rc;
+
+	/* CBO instructions raise store faults */
+	sbi_load_u8((const u8 *)vaddr, uptrap);
+	if (uptrap->cause == CAUSE_LOAD_ACCESS)
+		uptrap->cause = CAUSE_STORE_ACCESS;
+	else if (uptrap->cause == CAUSE_LOAD_PAGE_FAULT)
+		uptrap->cause = CAUSE_STORE_PAGE_FAULT;
+	if (uptrap->cause)
+		return SBI_ETRAP;
+
+	if (prev_mode == PRV_M) {
+		*paddr = vaddr;
+		return 0;
+	}
+
+	rc = cbo_walk(vaddr, paddr);
+	if (rc == SBI_EINVALID_ADDR || rc == SBI_EDENIED) {
+		/*
+		 * Page table changed under us or points at memory S-mode
+		 * can't access, report it like the hardware walker would.
+		 */
+		uptrap->cause = (rc == SBI_EDENIED) ? CAUSE_STORE_ACCESS :
+						      CAUSE_STORE_PAGE_FAULT;
+		uptrap->tval = vaddr;
+		uptrap->tval2 = 0;
+		uptrap->tinst = 0;
+		uptrap->gva = 0;
+		return SBI_ETRAP;
+	}
+
+	return rc;
+}
+
+static void cbo_zero_block(ulong vaddr, ulong bsize,
+			   struct sbi_trap_info *uptrap)
+{
+	static const ulong zeroes[8];
+	ulong off;
+
+	for (off = 0; off < bsize; off += sizeof(zeroes)) {
+		sbi_unpriv_copy_to((void *)(vaddr + off), zeroes,
+				   MIN(sizeof(zeroes), bsize - off), uptrap);
+		if (uptrap->cause)
+			return;
+	}
+}
+
+/*
+ * Kernels issue CBO instructions in a loop of the form
+ *
+ *	1: cbo.<op> (rs1)
+ *	   add rs1, rs1, <block size>
+ *	   bltu rs1, rs2, 1b
+ *
+ * Recognize it to handle the whole loop in one trap. Returns the number
+ * of iterations, which is one when the loop was not recognized, and the
+ * PC following the loop.
+ */
+static ulong cbo_batch_count(ulong insn, ulong bsize,
+			     struct sbi_trap_regs *regs, ulong *next_pc)
+{
+	ulong rs1 = RV_X(insn, SH_RS1, 5), val = GET_RS1(insn, regs);
+	ulong pc = regs->mepc, step, end, add_insn, br_insn, add_len;
+	struct sbi_trap_info uptrap;
+
+	*next_pc = pc + 4;
+	if (!rs1)
+		return 1;
+
+	add_insn = sbi_get_insn(pc + 4, &uptrap);
+	if (uptrap.cause)
+		return 1;
+	add_len = INSN_LEN(add_insn);
+
+	if ((add_insn & INSN_MASK_ADDI) == INSN_MATCH_ADDI &&
+	    RV_X(add_insn, SH_RD, 5) == rs1 &&
+	    RV_X(add_insn, SH_RS1, 5) == rs1)
+		step = IMM_I(add_insn);
+	else if ((add_insn & INSN_MASK_ADD) == INSN_MATCH_ADD &&
+		 RV_X(add_insn, SH_RD, 5) == rs1 &&
+		 RV_X(add_insn, SH_RS1, 5) == rs1)
+		step = *REG_PTR(RV_X(add_insn, SH_RS2, 5), 0, regs);
+	else if ((add_insn & INSN_MASK_ADD) == INSN_MATCH_ADD &&
+		 RV_X(add_insn, SH_RD, 5) == rs1 &&
+		 RV_X(add_insn, SH_RS2, 5) == rs1)
+		step = *REG_PTR(RV_X(add_insn, SH_RS1, 5), 0, regs);
+	else if ((add_insn & INSN_MASK_C_ADD) == INSN_MATCH_C_ADD &&
+		 RV_X(add_insn, SH_RD, 5) == rs1 && RVC_RS2(add_insn))
+		step = *REG_PTR(RVC_RS2(add_insn), 0, regs);
+	else if ((add_insn & INSN_MASK_C_ADDI) == INSN_MATCH_C_ADDI &&
+		 RV_X(add_insn, SH_RD, 5) == rs1)
+		step = RVC_ADDI_IMM(add_insn);
+	else
+		return 1;
+	if (step != bsize)
+		return 1;
+
+	br_insn = sbi_get_insn(pc + 4 + add_len, &uptrap);
+	if (uptrap.cause)
+		return 1;
+	if ((br_insn & INSN_MASK_BLTU) != INSN_MATCH_BLTU ||
+	    RV_X(br_insn, SH_RS1, 5) != rs1 ||
+	    pc + 4 + add_len + IMM_B(br_insn) != pc)
+		return 1;
+
+	end = *REG_PTR(RV_X(br_insn, SH_RS2, 5), 0, regs);
+	if (end > -bsize)
+		return 1;
+
+	*next_pc = pc + 4 + add_len + 4;
+
+	return (val < end) ? (end - val + bsize - 1) / bsize : 1;
+}
+
+static int cbo_insn(ulong insn, struct sbi_trap_regs *regs)
+{
+	const struct sbi_platform *plat = sbi_platform_thishart_ptr();
+	ulong bsize = sbi_platform_cbo_block_size(plat);
+	ulong rs1 = RV_X(insn, SH_RS1, 5), val = GET_RS1(insn, regs);
+	ulong addr, count, total, done, next_pc, paddr, n;
+	ulong prev_mode = (regs->mstatus & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT;
+	struct sbi_trap_info uptrap;
+	int op, rc;
+#if __riscv_xlen == 32
+	bool virt = (regs->mstatusH & MSTATUSH_MPV) ? TRUE : FALSE;
+#else
+	bool virt = (regs->mstatus & MSTATUS_MPV) ? TRUE : FALSE;
+#endif
+
+	/*
+	 * Without senvcfg there is no way to know whether S-mode allows
+	 * U-mode to use CBO instructions, and cbo.inval drops dirty data
+	 * without writeback, so only emulate them for S-mode.
+	 */
+	if (!bsize || virt || prev_mode == PRV_U)
+		return truly_illegal_insn(insn, regs);
+
+	switch (insn & INSN_MASK_CBO) {
+	case INSN_MATCH_CBO_INVAL:
+		op = SBI_CBO_INVAL;
+		break;
+	case INSN_MATCH_CBO_CLEAN:
+		op = SBI_CBO_CLEAN;
+		break;
+	case INSN_MATCH_CBO_FLUSH:
+		op = SBI_CBO_FLUSH;
+		break;
+	case INSN_MATCH_CBO_ZERO:
+		op = SBI_CBO_ZERO;
+		break;
+	default:
+		return truly_illegal_insn(insn, regs);
+	}
+
+	total = cbo_batch_count(insn, bsize, regs, &next_pc);
+	count = MIN(total, (ulong)CBO_BATCH_MAX);
+	addr  = val & ~(bsize - 1);
+
+	uptrap.cause = 0;
+	for (done = 0; done < count; done += n) {
+		if (op == SBI_CBO_ZERO) {
+			cbo_zero_block(addr + done * bsize, bsize, &uptrap);
+			if (uptrap.cause)
+				break;
+			n = 1;
+			continue;
+		}
+
+		rc = cbo_translate(addr + done * bsize, &paddr, regs, &uptrap);
+		if (rc == SBI_ETRAP)
+			break;
+		if (rc)
+			return truly_illegal_insn(insn, regs);
+
+		/* Blocks up to the end of the page are physically contiguous */
+		n = (PAGE_SIZE - ((addr + done * bsize) & (PAGE_SIZE - 1))) /
+		    bsize;
+		n = MIN(MAX(n, 1UL), count - done);
+
+		/*
+		 * The page table may have changed since the probe, and
+		 * cbo.inval drops data, so the blocks must be writable by
+		 * the trapping mode whatever the platform callback checks.
+		 */
+		if (!sbi_domain_check_addr_range(sbi_domain_thishart_ptr(),
+						 paddr, n * bsize, prev_mode,
+						 SBI_DOMAIN_READ |
+						 SBI_DOMAIN_WRITE)) {
+			uptrap.cause = CAUSE_STORE_ACCESS;
+			uptrap.tval = addr + done * bsize;
+			uptrap.tval2 = 0;
+			uptrap.tinst = 0;
+			uptrap.gva = 0;
+			break;
+		}
+		rc = sbi_platform_cbo_op(plat, op, paddr, n * bsize);
+		if (rc)
+			return truly_illegal_insn(insn, regs);
+	}
+
+	if (!done) {
+		uptrap.epc = regs->mepc;
+		return sbi_trap_redirect(regs, &uptrap);
+	}
+
+	/*
+	 * Resume after the loop when it completed, otherwise at the CBO
+	 * instruction with the loop register advanced past the blocks
+	 * done so far.
+	 */
+	if (total > 1)
+		*REG_PTR(rs1, 0, regs) = val + done * bsize;
+	regs->mepc = (done == total) ? next_pc : regs->mepc;
+
+	return 0;
+}
+
 static int misc_mem_opcode_insn(ulong insn, struct sbi_trap_regs *regs)
 {
 	/* Errata workaround: emulate `fence.tso` as `fence rw, rw`. */
@@ -44,6 +343,11 @@ static int misc_mem_opcode_insn(ulong insn, struct sbi_trap_regs *regs)
 		return 0;
 	}
 
+	/* Zicbom/Zicboz through platform cache operations */
+	if ((insn & MASK_FUNCT3) == (INSN_MATCH_CBO_INVAL & MASK_FUNCT3) &&
+	    !RV_X(insn, SH_RD, 5))
+		return cbo_insn(insn, regs);
+
 	return truly_illegal_insn(insn, regs);
 }
 
@@ -61,6 +365,17 @@ static int system_opcode_insn(ulong insn, struct sbi_trap_regs *regs)
 		return SBI_EFAIL;
 	}
 
+	/*
+	 * Tickless kernels write stimecmp on every timer event, so emulate
+	 * a plain "csrw stimecmp, rs1" without reading the CSR first.
+	 */
+	if (csr_num == CSR_STIMECMP && GET_RM(insn) == 1 &&
+	    !((insn >> 7) & 0x1f) &&
+	    !sbi_emulate_csr_write(csr_num, regs, rs1_val)) {
+		regs->mepc += 4;
+		return 0;
+	}
+
 	/* TODO: Ensure that we got CSR read/write instruction */
 
 	if (sbi_emulate_csr_read(csr_num, regs, &csr_val))
@@ -13,9 +13,37 @@
 #include <sbi/sbi_error.h>
 #include <sbi/sbi_misaligned_ldst.h>
 #include <sbi/sbi_pmu.h>
+#include <sbi/sbi_string.h>
 #include <sbi/sbi_trap.h>
 #include <sbi/sbi_unpriv.h>
 
+/* Kind of decoded instruction */
+enum misaligned_op_kind {
+	MISALIGNED_OP_NONE = 0,
+	MISALIGNED_OP_LOAD,
+	MISALIGNED_OP_STORE,
+};
+
+/* Decoded trapped instruction */
+struct misaligned_op {
+	/* Instruction, data register in the rd (load) or rs2 (store) field */
+	ulong insn;
+	/* Offset of the memory address from the base register */
+	long imm;
+	/* One of enum misaligned_op_kind */
+	u8 kind;
+	/* Instruction length in bytes */
+	u8 insn_len;
+	/* Base register index */
+	u8 base;
+	/* Memory access width in bytes */
+	u8 len;
+	/* Sign extension shift, zero for unsigned loads */
+	u8 shift;
+	/* Floating point data register */
+	u8 fp;
+};
+
 union reg_data {
 	u8 data_bytes[8];
 	ulong data_ulong;
@@ -34,212 +62,518 @@ static ulong sbi_misaligned_tinst_fixup(ulong orig_tinst, ulong new_tinst,
 		return orig_tinst | (addr_offset << SH_RS1);
 }
 
-int sbi_misaligned_load_handler(ulong addr, ulong tval2, ulong tinst,
-				struct sbi_trap_regs *regs)
+/*
+ * Read the data of a misaligned load. When all bytes are within one page
+ * this takes at most two aligned natural-width accesses which are then
+ * shifted and merged. Otherwise fall back to sbi_unpriv_copy_from() whose
+ * aligned accesses never cross a page so the reported fault address is
+ * exact.
+ *
+ * Returns the offset of the faulting access relative to addr when
+ * uptrap->cause is set.
+ */
+static ulong misaligned_load_data(ulong addr, int len, union reg_data *val,
+				  struct sbi_trap_info *uptrap)
 {
-	ulong insn, insn_len;
-	union reg_data val;
-	struct sbi_trap_info uptrap;
-	int i, fp = 0, shift = 0, len = 0;
+	ulong base, shift, w0, w1 = 0;
 
-	sbi_pmu_ctr_incr_fw(SBI_PMU_FW_MISALIGNED_LOAD);
+	val->data_u64 = 0;
 
-	if (tinst & 0x1) {
-		/*
-		 * Bit[0] == 1 implies trapped instruction value is
-		 * transformed instruction or custom instruction.
-		 */
-		insn = tinst | INSN_16BIT_MASK;
-		insn_len = (tinst & 0x2) ? INSN_LEN(insn) : 2;
-	} else {
-		/*
-		 * Bit[0] == 0 implies trapped instruction value is
-		 * zero or special value.
-		 */
-		insn = sbi_get_insn(regs->mepc, &uptrap);
-		if (uptrap.cause) {
-			uptrap.epc = regs->mepc;
-			return sbi_trap_redirect(regs, &uptrap);
+	if (len <= sizeof(ulong) &&
+	    (addr & PAGE_MASK) == ((addr + len - 1) & PAGE_MASK)) {
+		base  = addr & ~(sizeof(ulong) - 1);
+		shift = (addr - base) * 8;
+
+		w0 = sbi_load_ulong((const ulong *)base, uptrap);
+		if (uptrap->cause) {
+			/* Same page so report the original address */
+			uptrap->tval = addr;
+			return 0;
+		}
+		if (addr + len > base + sizeof(ulong)) {
+			w1 = sbi_load_ulong((const ulong *)(base + sizeof(ulong)),
+					    uptrap);
+			if (uptrap->cause)
+				return base + sizeof(ulong) - addr;
+		}
+
+		val->data_ulong = (shift) ?
+			(w0 >> shift) | (w1 << (__riscv_xlen - shift)) : w0;
+		if (len < sizeof(ulong))
+			val->data_ulong &= (1UL << (len * 8)) - 1;
+		return 0;
+	}
+
+	sbi_unpriv_copy_from(val->data_bytes, (const void *)addr, len, uptrap);
+	if (uptrap->cause)
+		return uptrap->tval - addr;
+
+	return 0;
+}
+
+/*
+ * Write the data of a misaligned store as a sequence of naturally aligned
+ * accesses of decreasing size. A read-modify-write of whole words would
+ * race with other harts updating the neighbouring bytes. Aligned accesses
+ * never cross a page so faults are exact.
+ *
+ * Returns the offset of the faulting access relative to addr when
+ * uptrap->cause is set.
+ */
+static ulong misaligned_store_data(ulong addr, int len, union reg_data *val,
+				   struct sbi_trap_info *uptrap)
+{
+	ulong cur;
+	u16 v16;
+	u32 v32;
+	u64 v64;
+	int i = 0;
+
+	uptrap->cause = 0;
+
+	while (i < len) {
+		cur = addr + i;
+		if (__riscv_xlen == 64 && !(cur & 0x7) && (len - i) >= 8) {
+			sbi_memcpy(&v64, &val->data_bytes[i], sizeof(v64));
+			sbi_store_u64((u64 *)cur, v64, uptrap);
+			if (uptrap->cause)
+				return i;
+			i += 8;
+		} else if (!(cur & 0x3) && (len - i) >= 4) {
+			sbi_memcpy(&v32, &val->data_bytes[i], sizeof(v32));
+			sbi_store_u32((u32 *)cur, v32, uptrap);
+			if (uptrap->cause)
+				return i;
+			i += 4;
+		} else if (!(cur & 0x1) && (len - i) >= 2) {
+			sbi_memcpy(&v16, &val->data_bytes[i], sizeof(v16));
+			sbi_store_u16((u16 *)cur, v16, uptrap);
+			if (uptrap->cause)
+				return i;
+			i += 2;
+		} else {
+			sbi_store_u8((u8 *)cur, val->data_bytes[i], uptrap);
+			if (uptrap->cause)
+				return i;
+			i += 1;
 		}
-		insn_len = INSN_LEN(insn);
 	}
 
+	return 0;
+}
+
+/*
+ * Maximum number of instructions following a trapped misaligned access
+ * which are emulated in the same trap. Zero disables the look-ahead.
+ */
+#ifdef CONFIG_SBI_MISALIGNED_LOOKAHEAD
+#define MISALIGNED_LOOKAHEAD_MAX	CONFIG_SBI_MISALIGNED_LOOKAHEAD
+#else
+#define MISALIGNED_LOOKAHEAD_MAX	0
+#endif
+
+static int misaligned_load_decode(ulong insn, struct misaligned_op *op)
+{
+	ulong rd = RV_X(insn, SH_RD, 5);
+
+	op->insn_len = INSN_LEN(insn);
+	op->base     = RV_X(insn, SH_RS1, 5);
+	op->imm	     = IMM_I(insn);
+	op->shift    = 0;
+	op->fp	     = 0;
+
 	if ((insn & INSN_MASK_LW) == INSN_MATCH_LW) {
-		len   = 4;
-		shift = 8 * (sizeof(ulong) - len);
+		op->len   = 4;
+		op->shift = 8 * (sizeof(ulong) - op->len);
 #if __riscv_xlen == 64
 	} else if ((insn & INSN_MASK_LD) == INSN_MATCH_LD) {
-		len   = 8;
-		shift = 8 * (sizeof(ulong) - len);
+		op->len   = 8;
+		op->shift = 8 * (sizeof(ulong) - op->len);
 	} else if ((insn & INSN_MASK_LWU) == INSN_MATCH_LWU) {
-		len = 4;
+		op->len = 4;
 #endif
 #ifdef __riscv_flen
 	} else if ((insn & INSN_MASK_FLD) == INSN_MATCH_FLD) {
-		fp  = 1;
-		len = 8;
+		op->fp  = 1;
+		op->len = 8;
 	} else if ((insn & INSN_MASK_FLW) == INSN_MATCH_FLW) {
-		fp  = 1;
-		len = 4;
+		op->fp  = 1;
+		op->len = 4;
 #endif
 	} else if ((insn & INSN_MASK_LH) == INSN_MATCH_LH) {
-		len   = 2;
-		shift = 8 * (sizeof(ulong) - len);
+		op->len   = 2;
+		op->shift = 8 * (sizeof(ulong) - op->len);
 	} else if ((insn & INSN_MASK_LHU) == INSN_MATCH_LHU) {
-		len = 2;
+		op->len = 2;
 #if __riscv_xlen >= 64
 	} else if ((insn & INSN_MASK_C_LD) == INSN_MATCH_C_LD) {
-		len   = 8;
-		shift = 8 * (sizeof(ulong) - len);
-		insn  = RVC_RS2S(insn) << SH_RD;
+		op->len   = 8;
+		op->shift = 8 * (sizeof(ulong) - op->len);
+		op->base  = RVC_RS1S(insn);
+		op->imm   = RVC_LD_IMM(insn);
+		rd	  = RVC_RS2S(insn);
 	} else if ((insn & INSN_MASK_C_LDSP) == INSN_MATCH_C_LDSP &&
 		   ((insn >> SH_RD) & 0x1f)) {
-		len   = 8;
-		shift = 8 * (sizeof(ulong) - len);
+		op->len   = 8;
+		op->shift = 8 * (sizeof(ulong) - op->len);
+		op->base  = 2;
+		op->imm   = RVC_LDSP_IMM(insn);
 #endif
 	} else if ((insn & INSN_MASK_C_LW) == INSN_MATCH_C_LW) {
-		len   = 4;
-		shift = 8 * (sizeof(ulong) - len);
-		insn  = RVC_RS2S(insn) << SH_RD;
+		op->len   = 4;
+		op->shift = 8 * (sizeof(ulong) - op->len);
+		op->base  = RVC_RS1S(insn);
+		op->imm   = RVC_LW_IMM(insn);
+		rd	  = RVC_RS2S(insn);
 	} else if ((insn & INSN_MASK_C_LWSP) == INSN_MATCH_C_LWSP &&
 		   ((insn >> SH_RD) & 0x1f)) {
-		len   = 4;
-		shift = 8 * (sizeof(ulong) - len);
+		op->len   = 4;
+		op->shift = 8 * (sizeof(ulong) - op->len);
+		op->base  = 2;
+		op->imm   = RVC_LWSP_IMM(insn);
 #ifdef __riscv_flen
 	} else if ((insn & INSN_MASK_C_FLD) == INSN_MATCH_C_FLD) {
-		fp   = 1;
-		len  = 8;
-		insn = RVC_RS2S(insn) << SH_RD;
+		op->fp   = 1;
+		op->len  = 8;
+		op->base = RVC_RS1S(insn);
+		op->imm  = RVC_LD_IMM(insn);
+		rd	 = RVC_RS2S(insn);
 	} else if ((insn & INSN_MASK_C_FLDSP) == INSN_MATCH_C_FLDSP) {
-		fp  = 1;
-		len = 8;
+		op->fp   = 1;
+		op->len  = 8;
+		op->base = 2;
+		op->imm  = RVC_LDSP_IMM(insn);
 #if __riscv_xlen == 32
 	} else if ((insn & INSN_MASK_C_FLW) == INSN_MATCH_C_FLW) {
-		fp   = 1;
-		len  = 4;
-		insn = RVC_RS2S(insn) << SH_RD;
+		op->fp   = 1;
+		op->len  = 4;
+		op->base = RVC_RS1S(insn);
+		op->imm  = RVC_LW_IMM(insn);
+		rd	 = RVC_RS2S(insn);
 	} else if ((insn & INSN_MASK_C_FLWSP) == INSN_MATCH_C_FLWSP) {
-		fp  = 1;
-		len = 4;
+		op->fp   = 1;
+		op->len  = 4;
+		op->base = 2;
+		op->imm  = RVC_LWSP_IMM(insn);
 #endif
 #endif
 	} else {
-		uptrap.epc = regs->mepc;
-		uptrap.cause = CAUSE_MISALIGNED_LOAD;
-		uptrap.tval = addr;
-		uptrap.tval2 = tval2;
-		uptrap.tinst = tinst;
-		uptrap.gva   = sbi_regs_gva(regs);
-		return sbi_trap_redirect(regs, &uptrap);
+		return SBI_EINVAL;
 	}
 
-	val.data_u64 = 0;
-	for (i = 0; i < len; i++) {
-		val.data_bytes[i] = sbi_load_u8((void *)(addr + i),
-						&uptrap);
-		if (uptrap.cause) {
-			uptrap.epc = regs->mepc;
-			uptrap.tinst = sbi_misaligned_tinst_fixup(
-				tinst, uptrap.tinst, i);
-			return sbi_trap_redirect(regs, &uptrap);
-		}
-	}
-
-	if (!fp)
-		SET_RD(insn, regs, ((long)(val.data_ulong << shift)) >> shift);
-#ifdef __riscv_flen
-	else if (len == 8)
-		SET_F64_RD(insn, regs, val.data_u64);
-	else
-		SET_F32_RD(insn, regs, val.data_ulong);
-#endif
-
-	regs->mepc += insn_len;
+	op->kind = MISALIGNED_OP_LOAD;
+	op->insn = rd << SH_RD;
 
 	return 0;
 }
 
-int sbi_misaligned_store_handler(ulong addr, ulong tval2, ulong tinst,
-				 struct sbi_trap_regs *regs)
+static int misaligned_store_decode(ulong insn, struct misaligned_op *op)
 {
-	ulong insn, insn_len;
-	union reg_data val;
-	struct sbi_trap_info uptrap;
-	int i, len = 0;
+	ulong rs2 = RV_X(insn, SH_RS2, 5);
 
-	sbi_pmu_ctr_incr_fw(SBI_PMU_FW_MISALIGNED_STORE);
-
-	if (tinst & 0x1) {
-		/*
-		 * Bit[0] == 1 implies trapped instruction value is
-		 * transformed instruction or custom instruction.
-		 */
-		insn = tinst | INSN_16BIT_MASK;
-		insn_len = (tinst & 0x2) ? INSN_LEN(insn) : 2;
-	} else {
-		/*
-		 * Bit[0] == 0 implies trapped instruction value is
-		 * zero or special value.
-		 */
-		insn = sbi_get_insn(regs->mepc, &uptrap);
-		if (uptrap.cause) {
-			uptrap.epc = regs->mepc;
-			return sbi_trap_redirect(regs, &uptrap);
-		}
-		insn_len = INSN_LEN(insn);
-	}
-
-	val.data_ulong = GET_RS2(insn, regs);
+	op->insn_len = INSN_LEN(insn);
+	op->base     = RV_X(insn, SH_RS1, 5);
+	op->imm	     = IMM_S(insn);
+	op->shift    = 0;
+	op->fp	     = 0;
 
 	if ((insn & INSN_MASK_SW) == INSN_MATCH_SW) {
-		len = 4;
+		op->len = 4;
 #if __riscv_xlen == 64
 	} else if ((insn & INSN_MASK_SD) == INSN_MATCH_SD) {
-		len = 8;
+		op->len = 8;
 #endif
 #ifdef __riscv_flen
 	} else if ((insn & INSN_MASK_FSD) == INSN_MATCH_FSD) {
-		len	     = 8;
-		val.data_u64 = GET_F64_RS2(insn, regs);
+		op->fp  = 1;
+		op->len = 8;
 	} else if ((insn & INSN_MASK_FSW) == INSN_MATCH_FSW) {
-		len	       = 4;
-		val.data_ulong = GET_F32_RS2(insn, regs);
+		op->fp  = 1;
+		op->len = 4;
 #endif
 	} else if ((insn & INSN_MASK_SH) == INSN_MATCH_SH) {
-		len = 2;
+		op->len = 2;
 #if __riscv_xlen >= 64
 	} else if ((insn & INSN_MASK_C_SD) == INSN_MATCH_C_SD) {
-		len	       = 8;
-		val.data_ulong = GET_RS2S(insn, regs);
+		op->len  = 8;
+		op->base = RVC_RS1S(insn);
+		op->imm  = RVC_LD_IMM(insn);
+		rs2	 = RVC_RS2S(insn);
 	} else if ((insn & INSN_MASK_C_SDSP) == INSN_MATCH_C_SDSP &&
 		   ((insn >> SH_RD) & 0x1f)) {
-		len	       = 8;
-		val.data_ulong = GET_RS2C(insn, regs);
+		op->len  = 8;
+		op->base = 2;
+		op->imm  = RVC_SDSP_IMM(insn);
+		rs2	 = RVC_RS2(insn);
 #endif
 	} else if ((insn & INSN_MASK_C_SW) == INSN_MATCH_C_SW) {
-		len	       = 4;
-		val.data_ulong = GET_RS2S(insn, regs);
+		op->len  = 4;
+		op->base = RVC_RS1S(insn);
+		op->imm  = RVC_LW_IMM(insn);
+		rs2	 = RVC_RS2S(insn);
 	} else if ((insn & INSN_MASK_C_SWSP) == INSN_MATCH_C_SWSP &&
 		   ((insn >> SH_RD) & 0x1f)) {
-		len	       = 4;
-		val.data_ulong = GET_RS2C(insn, regs);
+		op->len  = 4;
+		op->base = 2;
+		op->imm  = RVC_SWSP_IMM(insn);
+		rs2	 = RVC_RS2(insn);
 #ifdef __riscv_flen
 	} else if ((insn & INSN_MASK_C_FSD) == INSN_MATCH_C_FSD) {
-		len	     = 8;
-		val.data_u64 = GET_F64_RS2S(insn, regs);
+		op->fp   = 1;
+		op->len  = 8;
+		op->base = RVC_RS1S(insn);
+		op->imm  = RVC_LD_IMM(insn);
+		rs2	 = RVC_RS2S(insn);
 	} else if ((insn & INSN_MASK_C_FSDSP) == INSN_MATCH_C_FSDSP) {
-		len	     = 8;
-		val.data_u64 = GET_F64_RS2C(insn, regs);
+		op->fp   = 1;
+		op->len  = 8;
+		op->base = 2;
+		op->imm  = RVC_SDSP_IMM(insn);
+		rs2	 = RVC_RS2(insn);
 #if __riscv_xlen == 32
 	} else if ((insn & INSN_MASK_C_FSW) == INSN_MATCH_C_FSW) {
-		len	       = 4;
-		val.data_ulong = GET_F32_RS2S(insn, regs);
+		op->fp   = 1;
+		op->len  = 4;
+		op->base = RVC_RS1S(insn);
+		op->imm  = RVC_LW_IMM(insn);
+		rs2	 = RVC_RS2S(insn);
 	} else if ((insn & INSN_MASK_C_FSWSP) == INSN_MATCH_C_FSWSP) {
-		len	       = 4;
-		val.data_ulong = GET_F32_RS2C(insn, regs);
+		op->fp   = 1;
+		op->len  = 4;
+		op->base = 2;
+		op->imm  = RVC_SWSP_IMM(insn);
+		rs2	 = RVC_RS2(insn);
 #endif
 #endif
 	} else {
+		return SBI_EINVAL;
+	}
+
+	op->kind = MISALIGNED_OP_STORE;
+	op->insn = rs2 << SH_RS2;
+
+	return 0;
+}
+
+static void misaligned_load_writeback(const struct misaligned_op *op,
+				      union reg_data *val,
+				      struct sbi_trap_regs *regs)
+{
+	if (!op->fp)
+		SET_RD(op->insn, regs,
+		       ((long)(val->data_ulong << op->shift)) >> op->shift);
+#ifdef __riscv_flen
+	else if (op->len == 8)
+		SET_F64_RD(op->insn, regs, val->data_u64);
+	else
+		SET_F32_RD(op->insn, regs, val->data_ulong);
+#endif
+}
+
+static void misaligned_store_value(const struct misaligned_op *op,
+				   union reg_data *val,
+				   struct sbi_trap_regs *regs)
+{
+	val->data_u64 = 0;
+
+	if (!op->fp)
+		val->data_ulong = GET_RS2(op->insn, regs);
+#ifdef __riscv_flen
+	else if (op->len == 8)
+		val->data_u64 = GET_F64_RS2(op->insn, regs);
+	else
+		val->data_ulong = GET_F32_RS2(op->insn, regs);
+#endif
+}
+
+static int misaligned_decode(ulong insn, struct misaligned_op *op)
+{
+	if (!misaligned_load_decode(insn, op))
+		return 0;
+
+	return misaligned_store_decode(insn, op);
+}
+
+/*
+ * Get the decoded trapped instruction. Returns zero with uptrap->cause
+ * set when the fetch faulted.
+ */
+static int misaligned_get_op(ulong tinst, struct misaligned_op *op,
+			     struct sbi_trap_regs *regs,
+			     struct sbi_trap_info *uptrap)
+{
+	ulong insn;
+	int rc;
+
+	uptrap->cause = 0;
+
+	if (tinst & 0x1) {
+		/*
+		 * Bit[0] == 1 implies trapped instruction value is
+		 * transformed instruction or custom instruction.
+		 */
+		insn = tinst | INSN_16BIT_MASK;
+		rc = misaligned_decode(insn, op);
+		op->insn_len = (tinst & 0x2) ? INSN_LEN(insn) : 2;
+		return rc;
+	}
+
+	/*
+	 * Bit[0] == 0 implies trapped instruction value is
+	 * zero or special value.
+	 */
+	insn = sbi_get_insn(regs->mepc, uptrap);
+	if (uptrap->cause)
+		return 0;
+
+	return misaligned_decode(insn, op);
+}
+
+/*
+ * Instructions of the look-ahead did not execute yet, so an FP access
+ * must be left to the hardware when FP is off in the trapped context.
+ */
+static bool misaligned_fp_enabled(const struct sbi_trap_regs *regs)
+{
+#if __riscv_xlen == 32
+	bool prev_virt = (regs->mstatusH & MSTATUSH_MPV) ? TRUE : FALSE;
+#else
+	bool prev_virt = (regs->mstatus & MSTATUS_MPV) ? TRUE : FALSE;
+#endif
+
+	if (!(regs->mstatus & MSTATUS_FS))
+		return FALSE;
+	if (prev_virt && !(csr_read(CSR_VSSTATUS) & SSTATUS_FS))
+		return FALSE;
+
+	return TRUE;
+}
+
+/*
+ * Copy loops on unaligned buffers trap on every access. After emulating
+ * one access, also emulate the following loads and stores through the
+ * same base register as long as they are misaligned as well. Anything
+ * else, including a fault, ends the look-ahead and is left to the
+ * hardware which will trap again if needed.
+ *
+ * sbi_get_insn() fetches with MXR set, so it can read instructions from
+ * pages which are readable but not executable. Only the page of the
+ * trapped instruction at epc is known to be executable, so the
+ * look-ahead stops at its end.
+ */
+static void misaligned_lookahead(ulong base, ulong epc,
+				 struct sbi_trap_regs *regs)
+{
+	ulong page = epc & PAGE_MASK;
+	int budget = MISALIGNED_LOOKAHEAD_MAX;
+	struct sbi_trap_info uptrap;
+	struct misaligned_op op;
+	union reg_data val;
+	ulong addr;
+
+	while (budget--) {
+		if ((regs->mepc & PAGE_MASK) != page)
+			return;
+		if (misaligned_get_op(0, &op, regs, &uptrap))
+			return;
+		if (uptrap.cause)
+			return;
+		if (((regs->mepc + op.insn_len - 1) & PAGE_MASK) != page)
+			return;
+		if (op.kind != MISALIGNED_OP_LOAD && op.kind != MISALIGNED_OP_STORE)
+			return;
+
+		if (op.base != base)
+			return;
+		if (op.fp && !misaligned_fp_enabled(regs))
+			return;
+		addr = *REG_PTR(op.base, 0, regs) + op.imm;
+		if (!(addr & (op.len - 1)))
+			return;
+
+		if (op.kind == MISALIGNED_OP_STORE) {
+			misaligned_store_value(&op, &val, regs);
+			misaligned_store_data(addr, op.len, &val, &uptrap);
+			if (uptrap.cause)
+				return;
+			sbi_pmu_ctr_incr_fw(SBI_PMU_FW_MISALIGNED_STORE);
+		} else {
+			misaligned_load_data(addr, op.len, &val, &uptrap);
+			if (uptrap.cause)
+				return;
+			misaligned_load_writeback(&op, &val, regs);
+			sbi_pmu_ctr_incr_fw(SBI_PMU_FW_MISALIGNED_LOAD);
+		}
+
+		regs->mepc += op.insn_len;
+	}
+}
+
+int sbi_misaligned_load_handler(ulong addr, ulong tval2, ulong tinst,
+				struct sbi_trap_regs *regs)
+{
+	ulong off;
+	struct misaligned_op op;
+	union reg_data val;
+	struct sbi_trap_info uptrap;
+	int rc;
+
+	sbi_pmu_ctr_incr_fw(SBI_PMU_FW_MISALIGNED_LOAD);
+
+	rc = misaligned_get_op(tinst, &op, regs, &uptrap);
+	if (uptrap.cause) {
+		uptrap.epc = regs->mepc;
+		return sbi_trap_redirect(regs, &uptrap);
+	}
+
+	if (rc || op.kind != MISALIGNED_OP_LOAD) {
+		uptrap.epc = regs->mepc;
+		uptrap.cause = CAUSE_MISALIGNED_LOAD;
+		uptrap.tval = addr;
+		uptrap.tval2 = tval2;
+		uptrap.tinst = tinst;
+		uptrap.gva   = sbi_regs_gva(regs);
+		return sbi_trap_redirect(regs, &uptrap);
+	}
+
+	off = misaligned_load_data(addr, op.len, &val, &uptrap);
+	if (uptrap.cause) {
+		uptrap.epc = regs->mepc;
+		uptrap.tinst = sbi_misaligned_tinst_fixup(
+			tinst, uptrap.tinst, off);
+		return sbi_trap_redirect(regs, &uptrap);
+	}
+
+	misaligned_load_writeback(&op, &val, regs);
+
+	regs->mepc += op.insn_len;
+
+	/* Transformed instructions carry no base register */
+	if (!(tinst & 0x1))
+		misaligned_lookahead(op.base, regs->mepc - op.insn_len,
+				     regs);
+
+	return 0;
+}
+
+int sbi_misaligned_store_handler(ulong addr, ulong tval2, ulong tinst,
+				 struct sbi_trap_regs *regs)
+{
+	ulong off;
+	struct misaligned_op op;
+	union reg_data val;
+	struct sbi_trap_info uptrap;
+	int rc;
+
+	sbi_pmu_ctr_incr_fw(SBI_PMU_FW_MISALIGNED_STORE);
+
+	rc = misaligned_get_op(tinst, &op, regs, &uptrap);
+	if (uptrap.cause) {
+		uptrap.epc = regs->mepc;
+		return sbi_trap_redirect(regs, &uptrap);
+	}
+
+	if (rc || op.kind != MISALIGNED_OP_STORE) {
 		uptrap.epc = regs->mepc;
 		uptrap.cause = CAUSE_MISALIGNED_STORE;
 		uptrap.tval = addr;
@@ -249,18 +583,22 @@ int sbi_misaligned_store_handler(ulong addr, ulong tval2, ulong tinst,
 		return sbi_trap_redirect(regs, &uptrap);
 	}
 
-	for (i = 0; i < len; i++) {
-		sbi_store_u8((void *)(addr + i), val.data_bytes[i],
-			     &uptrap);
-		if (uptrap.cause) {
-			uptrap.epc = regs->mepc;
-			uptrap.tinst = sbi_misaligned_tinst_fixup(
-				tinst, uptrap.tinst, i);
-			return sbi_trap_redirect(regs, &uptrap);
-		}
+	misaligned_store_value(&op, &val, regs);
+
+	off = misaligned_store_data(addr, op.len, &val, &uptrap);
+	if (uptrap.cause) {
+		uptrap.epc = regs->mepc;
+		uptrap.tinst = sbi_misaligned_tinst_fixup(
+			tinst, uptrap.tinst, off);
+		return sbi_trap_redirect(regs, &uptrap);
 	}
 
-	regs->mepc += insn_len;
+	regs->mepc += op.insn_len;
+
+	/* Transformed instructions carry no base register */
+	if (!(tinst & 0x1))
+		misaligned_lookahead(op.base, regs->mepc - op.insn_len,
+				     regs);
 
 	return 0;
 }
@@ -10,12 +10,13 @@
 #include <sbi/riscv_asm.h>
 #include <sbi/sbi_bitops.h>
 #include <sbi/sbi_console.h>
+#include <sbi/sbi_domain.h>
 #include <sbi/sbi_ecall_interface.h>
 #include <sbi/sbi_hart.h>
-#include <sbi/sbi_hartmask.h>
 #include <sbi/sbi_platform.h>
 #include <sbi/sbi_pmu.h>
 #include <sbi/sbi_scratch.h>
+#include <sbi/sbi_timer.h>
 #include <sbi/sbi_string.h>
 
 /** Information about hardware counters */
@@ -56,17 +57,129 @@ static const struct sbi_pmu_device *pmu_dev = NULL;
 /* Mapping between event range and possible counters  */
 static struct sbi_pmu_hw_event hw_event_map[SBI_PMU_HW_EVENT_MAX] = {0};
 
-/* counter to enabled event mapping */
-static uint32_t active_events[SBI_HARTMASK_MAX_BITS][SBI_PMU_HW_CTR_MAX + SBI_PMU_FW_CTR_MAX];
+/* Indexes of the ranged events in hw_event_map sorted by start_idx */
+static uint16_t hw_event_sorted[SBI_PMU_HW_EVENT_MAX];
+static uint32_t num_hw_sorted;
+
+/* Indexes of the raw events in hw_event_map sorted by select_mask, select */
+static uint16_t hw_raw_sorted[SBI_PMU_HW_EVENT_MAX];
+static uint32_t num_hw_raw;
+
+/* Direct lookup of generic hardware events (index in hw_event_map + 1) */
+static uint16_t hw_generic_event[SBI_PMU_HW_GENERAL_MAX];
 
-/* Bitmap of firmware counters started on each HART */
 #if SBI_PMU_FW_CTR_MAX >= BITS_PER_LONG
 #error "Can't handle firmware counters beyond BITS_PER_LONG"
 #endif
-static unsigned long fw_counters_started[SBI_HARTMASK_MAX_BITS];
 
-/* Values of firmwares counters on each HART */
-static uint64_t fw_counters_value[SBI_HARTMASK_MAX_BITS][SBI_PMU_FW_CTR_MAX] = {0};
+/* Size and alignment of the snapshot shared memory */
+#define SBI_PMU_SNAPSHOT_SIZE	4096
+
+/* Layout of the snapshot shared memory as per SBI specification */
+struct sbi_pmu_snapshot {
+	/* Overflown counters relative to the counter index base */
+	uint64_t ctr_overflow_mask;
+	/* Counter values relative to the counter index base */
+	uint64_t ctr_values[64];
+};
+
+/* Longest supported event multiplexing period */
+#define SBI_PMU_MUX_PERIOD_MAX_US	1000000
+
+/**
+ * Hardware event time-sliced onto a firmware counter
+ *
+ * When COUNTER_CFG_MATCH finds no free hardware counter the event is
+ * given a firmware counter instead and the rotation timer schedules
+ * it on a hardware counter for some of the time. Reads of the firmware
+ * counter return the count scaled by time_enabled / time_running.
+ */
+struct sbi_pmu_mux_slot {
+	/* Event data passed to COUNTER_CFG_MATCH */
+	uint64_t data;
+	/* Timer ticks the counter was started */
+	uint64_t time_enabled;
+	/* Timer ticks the event was counted by a hardware counter */
+	uint64_t time_running;
+	/* Configuration flags passed to COUNTER_CFG_MATCH */
+	uint32_t flags;
+	/* Hardware counter while scheduled, zero otherwise */
+	uint32_t phys;
+};
+
+/* Number of guests with banked firmware counters on each HART */
+#define SBI_PMU_VMID_BANK_MAX	4
+
+/* Share of the firmware counter values caused by one guest */
+struct sbi_pmu_vmid_bank {
+	/* VMID of the guest, only valid when used */
+	unsigned long vmid;
+	bool used;
+	uint64_t values[SBI_PMU_FW_CTR_MAX];
+};
+
+/**
+ * Per-HART PMU state
+ *
+ * Firmware counters are updated from every trap path, so the state lives
+ * in a cache line aligned scratch allocation to keep HARTs from sharing
+ * cache lines.
+ */
+struct sbi_pmu_hart_state {
+	/* counter to enabled event mapping */
+	uint32_t active_events[SBI_PMU_HW_CTR_MAX + SBI_PMU_FW_CTR_MAX];
+	/* Bitmap of firmware counters started */
+	unsigned long fw_counters_started;
+	/* Values of firmwares counters */
+	uint64_t fw_counters_value[SBI_PMU_FW_CTR_MAX];
+	/* OpenSBI event of firmware counters mapped to SBI_PMU_FW_PLATFORM */
+	uint32_t fw_counters_data[SBI_PMU_FW_CTR_MAX];
+	/* Bitmap of overflown firmware counters */
+	unsigned long fw_counters_overflow;
+	/* Bitmap of programmable hardware counters not mapped to an event */
+	unsigned long hw_counters_free;
+	/* Bitmap of firmware counters not mapped to an event */
+	unsigned long fw_counters_free;
+	/* Snapshot shared memory registered by the supervisor */
+	struct sbi_pmu_snapshot *snapshot;
+	/* Bitmap of firmware counters multiplexing hardware events */
+	unsigned long mux_counters;
+	/* Bitmap of started multiplexed counters */
+	unsigned long mux_started;
+	/* Multiplexed counter to schedule first on next rotation */
+	uint32_t mux_next;
+	/* Timer value of the last time accounting */
+	uint64_t mux_stamp;
+	/* Rotation timer of multiplexed counters */
+	struct sbi_timer_event mux_event;
+	/* Multiplexing state of each firmware counter */
+	struct sbi_pmu_mux_slot mux[SBI_PMU_FW_CTR_MAX];
+	/* Firmware counter values banked per guest VMID */
+	struct sbi_pmu_vmid_bank vmid_banks[SBI_PMU_VMID_BANK_MAX];
+	/* Trap being handled was taken from VS or VU mode */
+	bool trap_virt;
+};
+
+/* Offset of per-HART PMU state in scratch space */
+static unsigned long phs_ptr_offset;
+
+#define pmu_get_hart_state_ptr(__scratch)				\
+	sbi_scratch_offset_ptr((__scratch), phs_ptr_offset)
+
+#define pmu_thishart_state_ptr()					\
+	pmu_get_hart_state_ptr(sbi_scratch_thishart_ptr())
+
+/* Event multiplexing period, zero when disabled */
+static unsigned long pmu_mux_period_us;
+
+struct pmu_ctr_batch;
+
+static uint64_t pmu_mux_read(struct sbi_pmu_hart_state *phs, uint32_t cidx);
+static int pmu_mux_start(struct sbi_pmu_hart_state *phs, uint32_t cidx,
+			 uint64_t ival, bool ival_update,
+			 struct pmu_ctr_batch *batch);
+static int pmu_mux_stop(struct sbi_pmu_hart_state *phs, uint32_t cidx,
+			struct pmu_ctr_batch *batch);
 
 /* Maximum number of hardware events available */
 static uint32_t num_hw_events;
@@ -106,6 +219,13 @@ static bool pmu_event_select_overlap(struct sbi_pmu_hw_event *evt,
 	return FALSE;
 }
 
+/* Check whether a firmware event code is implemented by pmu_dev */
+static bool pmu_fw_event_is_dev(uint32_t event_code)
+{
+	return (SBI_PMU_FW_MAX <= event_code &&
+		event_code != SBI_PMU_FW_PLATFORM) ? TRUE : FALSE;
+}
+
 static int pmu_event_validate(unsigned long event_idx)
 {
 	uint32_t event_idx_type = get_cidx_type(event_idx);
@@ -118,6 +238,9 @@ static int pmu_event_validate(unsigned long event_idx)
 		event_idx_code_max = SBI_PMU_HW_GENERAL_MAX;
 		break;
 	case SBI_PMU_EVENT_TYPE_FW:
+		/* OpenSBI events are checked against event_data on match */
+		if (event_idx_code == SBI_PMU_FW_PLATFORM)
+			return event_idx_type;
 		if (SBI_PMU_FW_MAX <= event_idx_code &&
 		    pmu_dev && pmu_dev->fw_event_validate_code)
 			return pmu_dev->fw_event_validate_code(event_idx_code);
@@ -157,12 +280,12 @@ static int pmu_ctr_validate(uint32_t cidx, uint32_t *event_idx_code)
 {
 	uint32_t event_idx_val;
 	uint32_t event_idx_type;
-	u32 hartid = current_hartid();
+	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
 
 	if (cidx >= total_ctrs)
 		return SBI_EINVAL;
 
-	event_idx_val = active_events[hartid][cidx];
+	event_idx_val = phs->active_events[cidx];
 	event_idx_type = get_cidx_type(event_idx_val);
 	if (event_idx_val == SBI_PMU_EVENT_IDX_INVALID ||
 	    event_idx_type >= SBI_PMU_EVENT_TYPE_MAX)
@@ -173,31 +296,117 @@ static int pmu_ctr_validate(uint32_t cidx, uint32_t *event_idx_code)
 	return event_idx_type;
 }
 
+static bool pmu_ctr_is_mux(struct sbi_pmu_hart_state *phs, uint32_t cidx)
+{
+	if (cidx < num_hw_ctrs || total_ctrs <= cidx)
+		return FALSE;
+
+	return (phs->mux_counters & BIT(cidx - num_hw_ctrs)) ? TRUE : FALSE;
+}
+
+static void pmu_ctr_mark_free(struct sbi_pmu_hart_state *phs, uint32_t cidx,
+			      bool free)
+{
+	int i;
+	unsigned long *map;
+
+	if (cidx < 3)
+		return;
+
+	if (cidx < num_hw_ctrs) {
+		map = &phs->hw_counters_free;
+	} else {
+		map = &phs->fw_counters_free;
+		cidx -= num_hw_ctrs;
+	}
+
+	if (free)
+		*map |= BIT(cidx);
+	else
+		*map &= ~BIT(cidx);
+
+	/* Guest shares of a released firmware counter are meaningless */
+	if (free && map == &phs->fw_counters_free) {
+		for (i = 0; i < SBI_PMU_VMID_BANK_MAX; i++)
+			phs->vmid_banks[i].values[cidx] = 0;
+	}
+}
+
 int sbi_pmu_ctr_fw_read(uint32_t cidx, uint64_t *cval)
 {
 	int event_idx_type;
 	uint32_t event_code;
-	u32 hartid = current_hartid();
+	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
 
 	event_idx_type = pmu_ctr_validate(cidx, &event_code);
+	if (event_idx_type >= 0 && pmu_ctr_is_mux(phs, cidx)) {
+		*cval = pmu_mux_read(phs, cidx);
+		return 0;
+	}
 	if (event_idx_type != SBI_PMU_EVENT_TYPE_FW)
 		return SBI_EINVAL;
 
-	if (SBI_PMU_FW_MAX <= event_code &&
+	if (pmu_fw_event_is_dev(event_code) &&
 	    pmu_dev && pmu_dev->fw_counter_read_value)
-		fw_counters_value[hartid][cidx - num_hw_ctrs] =
+		phs->fw_counters_value[cidx - num_hw_ctrs] =
 			pmu_dev->fw_counter_read_value(cidx - num_hw_ctrs);
 
-	*cval = fw_counters_value[hartid][cidx - num_hw_ctrs];
+	*cval = phs->fw_counters_value[cidx - num_hw_ctrs];
 
 	return 0;
 }
 
+/* Position of the first ranged event starting after eidx */
+static uint32_t pmu_event_range_upper(uint32_t eidx)
+{
+	uint32_t lo = 0, hi = num_hw_sorted, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (hw_event_map[hw_event_sorted[mid]].start_idx <= eidx)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Position of the first raw event not ordered before (select_mask, select) */
+static uint32_t pmu_event_raw_lower(uint64_t select, uint64_t select_mask)
+{
+	uint32_t lo = 0, hi = num_hw_raw, mid;
+	struct sbi_pmu_hw_event *evt;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		evt = &hw_event_map[hw_raw_sorted[mid]];
+		if (evt->select_mask < select_mask ||
+		    (evt->select_mask == select_mask && evt->select < select))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void pmu_event_sorted_insert(uint16_t *sorted, uint32_t *count,
+				    uint32_t pos, uint16_t index)
+{
+	uint32_t i;
+
+	for (i = *count; i > pos; i--)
+		sorted[i] = sorted[i - 1];
+	sorted[pos] = index;
+	(*count)++;
+}
+
 static int pmu_add_hw_event_map(u32 eidx_start, u32 eidx_end, u32 cmap,
 				uint64_t select, uint64_t select_mask)
 {
-	int i = 0;
-	bool is_overlap;
+	uint32_t i, pos;
+	bool is_overlap = FALSE;
 	struct sbi_pmu_hw_event *event = &hw_event_map[num_hw_events];
 	struct sbi_scratch *scratch = sbi_scratch_thishart_ptr();
 	int hw_ctr_avail = sbi_hart_mhpm_count(scratch);
@@ -216,22 +425,43 @@ static int pmu_add_hw_event_map(u32 eidx_start, u32 eidx_end, u32 cmap,
 	event->start_idx = eidx_start;
 	event->end_idx = eidx_end;
 
-	/* Sanity check */
-	for (i = 0; i < num_hw_events; i++) {
-		if (eidx_start == SBI_PMU_EVENT_RAW_IDX)
+	/* Sanity check against the neighbours in the sorted lookup tables */
+	if (eidx_start == SBI_PMU_EVENT_RAW_IDX) {
 		/* All raw events have same event idx. Just do sanity check on select */
-			is_overlap = pmu_event_select_overlap(&hw_event_map[i],
-							      select, select_mask);
-		else
-			is_overlap = pmu_event_range_overlap(&hw_event_map[i], event);
-		if (is_overlap)
-			goto reset_event;
+		pos = pmu_event_raw_lower(select, select_mask);
+		if (pos < num_hw_raw)
+			is_overlap = pmu_event_select_overlap(
+					&hw_event_map[hw_raw_sorted[pos]],
+					select, select_mask);
+	} else {
+		pos = pmu_event_range_upper(eidx_start);
+		if (pos > 0)
+			is_overlap = pmu_event_range_overlap(
+					&hw_event_map[hw_event_sorted[pos - 1]],
+					event);
+		if (!is_overlap && pos < num_hw_sorted)
+			is_overlap = pmu_event_range_overlap(
+					&hw_event_map[hw_event_sorted[pos]],
+					event);
 	}
+	if (is_overlap)
+		goto reset_event;
 
 	event->select_mask = select_mask;
 	/* Map the only the counters that are available in the hardware */
 	event->counters = cmap & ctr_avail_mask;
 	event->select = select;
+
+	if (eidx_start == SBI_PMU_EVENT_RAW_IDX) {
+		pmu_event_sorted_insert(hw_raw_sorted, &num_hw_raw, pos,
+					num_hw_events);
+	} else {
+		pmu_event_sorted_insert(hw_event_sorted, &num_hw_sorted, pos,
+					num_hw_events);
+		for (i = eidx_start;
+		     i <= eidx_end && i < SBI_PMU_HW_GENERAL_MAX; i++)
+			hw_generic_event[i] = num_hw_events + 1;
+	}
 	num_hw_events++;
 
 	return 0;
@@ -262,11 +492,10 @@ int sbi_pmu_add_raw_event_counter_map(uint64_t select, uint64_t select_mask, u32
 				    SBI_PMU_EVENT_RAW_IDX, cmap, select, select_mask);
 }
 
-static int pmu_ctr_enable_irq_hw(int ctr_idx)
+static int pmu_ctr_enable_irq_hw(int ctr_idx, unsigned long mip_val)
 {
 	unsigned long mhpmevent_csr;
 	unsigned long mhpmevent_curr;
-	unsigned long mip_val;
 	unsigned long of_mask;
 
 	if (ctr_idx < 3 || ctr_idx >= SBI_PMU_HW_CTR_MAX)
@@ -281,7 +510,6 @@ static int pmu_ctr_enable_irq_hw(int ctr_idx)
 #endif
 
 	mhpmevent_curr = csr_read_num(mhpmevent_csr);
-	mip_val = csr_read(CSR_MIP);
 	/**
 	 * Clear out the OF bit so that next interrupt can be enabled.
 	 * This should be done only when the corresponding overflow interrupt
@@ -309,41 +537,120 @@ static void pmu_ctr_write_hw(uint32_t cidx, uint64_t ival)
 #endif
 }
 
-static int pmu_ctr_start_hw(uint32_t cidx, uint64_t ival, bool ival_update)
+static uint64_t pmu_ctr_read_hw(uint32_t cidx)
 {
-	struct sbi_scratch *scratch = sbi_scratch_thishart_ptr();
+#if __riscv_xlen == 32
+	uint32_t hi, lo;
+
+	do {
+		hi = csr_read_num(CSR_MCYCLEH + cidx);
+		lo = csr_read_num(CSR_MCYCLE + cidx);
+	} while (hi != csr_read_num(CSR_MCYCLEH + cidx));
+
+	return ((uint64_t)hi << 32) | lo;
+#else
+	return csr_read_num(CSR_MCYCLE + cidx);
+#endif
+}
+
+static bool pmu_ctr_overflow_hw(uint32_t cidx)
+{
+	if (cidx < 3 || cidx >= SBI_PMU_HW_CTR_MAX ||
+	    !sbi_hart_has_extension(sbi_scratch_thishart_ptr(),
+				    SBI_HART_EXT_SSCOFPMF))
+		return FALSE;
+
+#if __riscv_xlen == 32
+	return (csr_read_num(CSR_MHPMEVENT3H + cidx - 3) & MHPMEVENTH_OF) ?
+		TRUE : FALSE;
+#else
+	return (csr_read_num(CSR_MHPMEVENT3 + cidx - 3) & MHPMEVENT_OF) ?
+		TRUE : FALSE;
+#endif
+}
+
+/**
+ * Hardware counters of one start or stop call are handled as a batch.
+ * Per-counter setup is done first and mcountinhibit is written once at
+ * the end, so all counters of a group count exactly the same interval.
+ */
+struct pmu_ctr_batch {
+	/* mcountinhibit is implemented */
+	bool inhibit;
+	/* Sscofpmf is implemented */
+	bool sscof;
+	/* mcountinhibit value to write at commit */
 	unsigned long mctr_inhbt;
+	/* MIP sampled once for the Sscofpmf overflow interrupt handling */
+	unsigned long mip_val;
+	/* mctr_inhbt differs from the CSR */
+	bool dirty;
+};
+
+static void pmu_ctr_batch_begin(struct pmu_ctr_batch *batch)
+{
+	struct sbi_scratch *scratch = sbi_scratch_thishart_ptr();
+
+	batch->inhibit = (sbi_hart_priv_version(scratch) >=
+			  SBI_HART_PRIV_VER_1_11) ? TRUE : FALSE;
+	batch->sscof = sbi_hart_has_extension(scratch, SBI_HART_EXT_SSCOFPMF);
+	batch->mctr_inhbt = batch->inhibit ? csr_read(CSR_MCOUNTINHIBIT) : 0;
+	batch->mip_val = batch->sscof ? csr_read(CSR_MIP) : 0;
+	batch->dirty = FALSE;
+}
+
+static void pmu_ctr_batch_commit(struct pmu_ctr_batch *batch)
+{
+	if (batch->dirty)
+		csr_write(CSR_MCOUNTINHIBIT, batch->mctr_inhbt);
+	batch->dirty = FALSE;
+}
 
+static int pmu_ctr_start_hw_batch(struct pmu_ctr_batch *batch, uint32_t cidx,
+				  uint64_t ival, bool ival_update)
+{
 	/* Make sure the counter index lies within the range and is not TM bit */
 	if (cidx >= num_hw_ctrs || cidx == 1)
 		return SBI_EINVAL;
 
-	if (sbi_hart_priv_version(scratch) < SBI_HART_PRIV_VER_1_11)
+	if (!batch->inhibit)
 		goto skip_inhibit_update;
 
 	/*
 	 * Some of the hardware may not support mcountinhibit but perf stat
 	 * still can work if supervisor mode programs the initial value.
 	 */
-	mctr_inhbt = csr_read(CSR_MCOUNTINHIBIT);
-	if (!__test_bit(cidx, &mctr_inhbt))
+	if (!__test_bit(cidx, &batch->mctr_inhbt))
 		return SBI_EALREADY_STARTED;
 
-	__clear_bit(cidx, &mctr_inhbt);
+	__clear_bit(cidx, &batch->mctr_inhbt);
+	batch->dirty = TRUE;
 
-	if (sbi_hart_has_extension(scratch, SBI_HART_EXT_SSCOFPMF))
-		pmu_ctr_enable_irq_hw(cidx);
+	if (batch->sscof)
+		pmu_ctr_enable_irq_hw(cidx, batch->mip_val);
 	if (pmu_dev && pmu_dev->hw_counter_enable_irq)
 		pmu_dev->hw_counter_enable_irq(cidx);
-	csr_write(CSR_MCOUNTINHIBIT, mctr_inhbt);
 
 skip_inhibit_update:
+	/* The counter is still inhibited until the batch is committed */
 	if (ival_update)
 		pmu_ctr_write_hw(cidx, ival);
 
 	return 0;
 }
 
+static int pmu_ctr_start_hw(uint32_t cidx, uint64_t ival, bool ival_update)
+{
+	struct pmu_ctr_batch batch;
+	int ret;
+
+	pmu_ctr_batch_begin(&batch);
+	ret = pmu_ctr_start_hw_batch(&batch, cidx, ival, ival_update);
+	pmu_ctr_batch_commit(&batch);
+
+	return ret;
+}
+
 int sbi_pmu_irq_bit(void)
 {
 	struct sbi_scratch *scratch = sbi_scratch_thishart_ptr();
@@ -360,9 +667,9 @@ static int pmu_ctr_start_fw(uint32_t cidx, uint32_t event_code,
 			    uint64_t ival, bool ival_update)
 {
 	int ret;
-	u32 hartid = current_hartid();
+	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
 
-	if (SBI_PMU_FW_MAX <= event_code &&
+	if (pmu_fw_event_is_dev(event_code) &&
 	    pmu_dev && pmu_dev->fw_counter_start) {
 		ret = pmu_dev->fw_counter_start(cidx - num_hw_ctrs,
 						event_code,
@@ -372,8 +679,10 @@ static int pmu_ctr_start_fw(uint32_t cidx, uint32_t event_code,
 	}
 
 	if (ival_update)
-		fw_counters_value[hartid][cidx - num_hw_ctrs] = ival;
-	fw_counters_started[hartid] |= BIT(cidx - num_hw_ctrs);
+		phs->fw_counters_value[cidx - num_hw_ctrs] = ival;
+	/* Like the OF bit of Sscofpmf, restarting re-arms the overflow */
+	phs->fw_counters_overflow &= ~BIT(cidx - num_hw_ctrs);
+	phs->fw_counters_started |= BIT(cidx - num_hw_ctrs);
 
 	return 0;
 }
@@ -381,6 +690,9 @@ static int pmu_ctr_start_fw(uint32_t cidx, uint32_t event_code,
 int sbi_pmu_ctr_start(unsigned long cbase, unsigned long cmask,
 		      unsigned long flags, uint64_t ival)
 {
+	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
+	struct sbi_pmu_snapshot *snap = NULL;
+	struct pmu_ctr_batch batch;
 	int event_idx_type;
 	uint32_t event_code;
 	int ret = SBI_EINVAL;
@@ -393,38 +705,48 @@ int sbi_pmu_ctr_start(unsigned long cbase, unsigned long cmask,
 	if (flags & SBI_PMU_START_FLAG_SET_INIT_VALUE)
 		bUpdate = TRUE;
 
+	/* Initial values may come from the snapshot shared memory */
+	if (flags & SBI_PMU_START_FLAG_INIT_SNAPSHOT) {
+		snap = phs->snapshot;
+		if (!snap)
+			return SBI_ENO_SHMEM;
+		bUpdate = TRUE;
+	}
+
+	pmu_ctr_batch_begin(&batch);
 	for_each_set_bit(i, &cmask, total_ctrs) {
 		cidx = i + cbase;
+		if (snap)
+			ival = snap->ctr_values[i];
 		event_idx_type = pmu_ctr_validate(cidx, &event_code);
 		if (event_idx_type < 0)
 			/* Continue the start operation for other counters */
 			continue;
+		else if (pmu_ctr_is_mux(phs, cidx))
+			ret = pmu_mux_start(phs, cidx, ival, bUpdate, &batch);
 		else if (event_idx_type == SBI_PMU_EVENT_TYPE_FW)
 			ret = pmu_ctr_start_fw(cidx, event_code, ival, bUpdate);
 		else
-			ret = pmu_ctr_start_hw(cidx, ival, bUpdate);
+			ret = pmu_ctr_start_hw_batch(&batch, cidx, ival,
+						     bUpdate);
 	}
+	pmu_ctr_batch_commit(&batch);
 
 	return ret;
 }
 
-static int pmu_ctr_stop_hw(uint32_t cidx)
+static int pmu_ctr_stop_hw_batch(struct pmu_ctr_batch *batch, uint32_t cidx)
 {
-	struct sbi_scratch *scratch = sbi_scratch_thishart_ptr();
-	unsigned long mctr_inhbt;
-
-	if (sbi_hart_priv_version(scratch) < SBI_HART_PRIV_VER_1_11)
+	if (!batch->inhibit)
 		return 0;
 
-	mctr_inhbt = csr_read(CSR_MCOUNTINHIBIT);
-
 	/* Make sure the counter index lies within the range and is not TM bit */
 	if (cidx >= num_hw_ctrs || cidx == 1)
 		return SBI_EINVAL;
 
-	if (!__test_bit(cidx, &mctr_inhbt)) {
-		__set_bit(cidx, &mctr_inhbt);
-		csr_write(CSR_MCOUNTINHIBIT, mctr_inhbt);
+	if (!__test_bit(cidx, &batch->mctr_inhbt)) {
+		__set_bit(cidx, &batch->mctr_inhbt);
+		batch->dirty = TRUE;
 		return 0;
 	} else
 		return SBI_EALREADY_STOPPED;
@@ -433,15 +755,16 @@ static int pmu_ctr_stop_hw(uint32_t cidx)
 static int pmu_ctr_stop_fw(uint32_t cidx, uint32_t event_code)
 {
 	int ret;
+	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
 
-	if (SBI_PMU_FW_MAX <= event_code &&
+	if (pmu_fw_event_is_dev(event_code) &&
 	    pmu_dev && pmu_dev->fw_counter_stop) {
 		ret = pmu_dev->fw_counter_stop(cidx - num_hw_ctrs);
 		if (ret)
 			return ret;
 	}
 
-	fw_counters_started[current_hartid()] &= ~BIT(cidx - num_hw_ctrs);
+	phs->fw_counters_started &= ~BIT(cidx - num_hw_ctrs);
 
 	return 0;
 }
@@ -465,7 +788,11 @@ static int pmu_reset_hw_mhpmevent(int ctr_idx)
 int sbi_pmu_ctr_stop(unsigned long cbase, unsigned long cmask,
 		     unsigned long flag)
 {
-	u32 hartid = current_hartid();
+	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
+	struct sbi_pmu_snapshot *snap = NULL;
+	uint64_t of_mask = 0, cval = 0;
+	unsigned long stopped = 0;
+	struct pmu_ctr_batch batch;
 	int ret = SBI_EINVAL;
 	int event_idx_type;
 	uint32_t event_code;
@@ -474,6 +801,13 @@ int sbi_pmu_ctr_stop(unsigned long cbase, unsigned long cmask,
 	if ((cbase + sbi_fls(cmask)) >= total_ctrs)
 		return SBI_EINVAL;
 
+	if (flag & SBI_PMU_STOP_FLAG_TAKE_SNAPSHOT) {
+		snap = phs->snapshot;
+		if (!snap)
+			return SBI_ENO_SHMEM;
+	}
+
+	pmu_ctr_batch_begin(&batch);
 	for_each_set_bit(i, &cmask, total_ctrs) {
 		cidx = i + cbase;
 		event_idx_type = pmu_ctr_validate(cidx, &event_code);
@@ -481,17 +815,51 @@ int sbi_pmu_ctr_stop(unsigned long cbase, unsigned long cmask,
 			/* Continue the stop operation for other counters */
 			continue;
 
+		else if (pmu_ctr_is_mux(phs, cidx))
+			ret = pmu_mux_stop(phs, cidx, &batch);
 		else if (event_idx_type == SBI_PMU_EVENT_TYPE_FW)
 			ret = pmu_ctr_stop_fw(cidx, event_code);
 		else
-			ret = pmu_ctr_stop_hw(cidx);
+			ret = pmu_ctr_stop_hw_batch(&batch, cidx);
+		stopped |= BIT(i);
+	}
+	pmu_ctr_batch_commit(&batch);
+
+	if (!snap && !(flag & SBI_PMU_STOP_FLAG_RESET))
+		return ret;
+
+	for_each_set_bit(i, &stopped, total_ctrs) {
+		cidx = i + cbase;
+		event_idx_type = pmu_ctr_validate(cidx, &event_code);
+
+		/* Save the value before a reset clears the event mapping */
+		if (snap) {
+			if (event_idx_type == SBI_PMU_EVENT_TYPE_FW ||
+			    pmu_ctr_is_mux(phs, cidx)) {
+				sbi_pmu_ctr_fw_read(cidx, &cval);
+				if (phs->fw_counters_overflow &
+				    BIT(cidx - num_hw_ctrs))
+					of_mask |= (1ULL << i);
+			} else {
+				cval = pmu_ctr_read_hw(cidx);
+				if (pmu_ctr_overflow_hw(cidx))
+					of_mask |= (1ULL << i);
+			}
+			snap->ctr_values[i] = cval;
+		}
 
 		if (flag & SBI_PMU_STOP_FLAG_RESET) {
-			active_events[hartid][cidx] = SBI_PMU_EVENT_IDX_INVALID;
+			phs->active_events[cidx] = SBI_PMU_EVENT_IDX_INVALID;
+			pmu_ctr_mark_free(phs, cidx, TRUE);
+			if (pmu_ctr_is_mux(phs, cidx))
+				phs->mux_counters &= ~BIT(cidx - num_hw_ctrs);
 			pmu_reset_hw_mhpmevent(cidx);
 		}
 	}
 
+	if (snap)
+		snap->ctr_overflow_mask = of_mask;
+
 	return ret;
 }
 
@@ -558,14 +926,89 @@ static int pmu_ctr_find_fixed_fw(unsigned long evt_idx_code)
 		return SBI_EINVAL;
 }
 
-static int pmu_ctr_find_hw(unsigned long cbase, unsigned long cmask, unsigned long flags,
-			   unsigned long event_idx, uint64_t data)
+static struct sbi_pmu_hw_event *pmu_event_find_range(unsigned long event_idx)
+{
+	struct sbi_pmu_hw_event *evt;
+	uint32_t pos;
+
+	if (event_idx < SBI_PMU_HW_GENERAL_MAX) {
+		if (!hw_generic_event[event_idx])
+			return NULL;
+		return &hw_event_map[hw_generic_event[event_idx] - 1];
+	}
+
+	/* Ranges don't overlap so only the last one starting before matters */
+	pos = pmu_event_range_upper(event_idx);
+	if (!pos)
+		return NULL;
+	evt = &hw_event_map[hw_event_sorted[pos - 1]];
+
+	return (event_idx <= evt->end_idx) ? evt : NULL;
+}
+
+/**
+ * Find the next raw event matching the event data. The search starts
+ * with the selector mask at position *pos of the raw event table and
+ * *pos is moved to the next selector mask.
+ */
+static struct sbi_pmu_hw_event *pmu_event_find_raw(uint64_t data,
+						   uint32_t *pos)
+{
+	struct sbi_pmu_hw_event *evt;
+	uint64_t select_mask;
+	uint32_t i;
+
+	while (*pos < num_hw_raw) {
+		select_mask = hw_event_map[hw_raw_sorted[*pos]].select_mask;
+		i = pmu_event_raw_lower(data & select_mask, select_mask);
+		*pos = (select_mask == -1ULL) ? num_hw_raw :
+			pmu_event_raw_lower(0, select_mask + 1);
+		if (i >= num_hw_raw)
+			continue;
+
+		/* The non-event map bits of data should match the selector */
+		evt = &hw_event_map[hw_raw_sorted[i]];
+		if (evt->select_mask == select_mask &&
+		    evt->select == (data & select_mask))
+			return evt;
+	}
+
+	return NULL;
+}
+
+static int pmu_ctr_alloc_hw(struct sbi_pmu_hw_event *evt, unsigned long cbase,
+			    unsigned long cmask, unsigned long mctr_inhbt,
+			    struct sbi_pmu_hart_state *phs)
 {
 	unsigned long ctr_mask;
-	int i, ret = 0, fixed_ctr, ctr_idx = SBI_ENOTSUPP;
-	struct sbi_pmu_hw_event *temp;
-	unsigned long mctr_inhbt = 0;
-	u32 hartid = current_hartid();
+
+	/**
+	 * Fixed counters should not be part of the search. A counter must
+	 * not be mapped already and, if mcountinhibit is supported, it must
+	 * not be running either.
+	 */
+	ctr_mask = evt->counters & (cmask << cbase) &
+		   (~SBI_PMU_FIXED_CTR_MASK) & phs->hw_counters_free &
+		   mctr_inhbt;
+	if (!ctr_mask)
+		return SBI_ENOTSUPP;
+
+	return sbi_ffs(ctr_mask);
+}
+
+/*
+ * Counters stopped by a batch that is not committed yet are only
+ * inhibited in the batch, so the batch mask is used when there is one.
+ */
+static int pmu_ctr_find_hw(unsigned long cbase, unsigned long cmask, unsigned long flags,
+			   unsigned long event_idx, uint64_t data,
+			   struct pmu_ctr_batch *batch)
+{
+	uint32_t pos = 0;
+	int ret = 0, fixed_ctr, ctr_idx = SBI_ENOTSUPP;
+	struct sbi_pmu_hw_event *temp = NULL;
+	unsigned long mctr_inhbt = -1UL;
+	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
 	struct sbi_scratch *scratch = sbi_scratch_thishart_ptr();
 
 	if (cbase >= num_hw_ctrs)
@@ -580,39 +1023,25 @@ static int pmu_ctr_find_hw(unsigned long cbase, unsigned long cmask, unsigned lo
 	    !sbi_hart_has_extension(scratch, SBI_HART_EXT_SSCOFPMF))
 		return fixed_ctr;
 
-	if (sbi_hart_priv_version(scratch) >= SBI_HART_PRIV_VER_1_11)
+	if (batch) {
+		if (batch->inhibit)
+			mctr_inhbt = batch->mctr_inhbt;
+	} else if (sbi_hart_priv_version(scratch) >= SBI_HART_PRIV_VER_1_11)
 		mctr_inhbt = csr_read(CSR_MCOUNTINHIBIT);
-	for (i = 0; i < num_hw_events; i++) {
-		temp = &hw_event_map[i];
-		if ((temp->start_idx > event_idx && event_idx < temp->end_idx) ||
-		    (temp->start_idx < event_idx && event_idx > temp->end_idx))
-			continue;
 
+	if (event_idx == SBI_PMU_EVENT_RAW_IDX) {
 		/* For raw events, event data is used as the select value */
-		if (event_idx == SBI_PMU_EVENT_RAW_IDX) {
-			uint64_t select_mask = temp->select_mask;
-
-			/* The non-event map bits of data should match the selector */
-			if (temp->select != (data & select_mask))
-				continue;
-		}
-		/* Fixed counters should not be part of the search */
-		ctr_mask = temp->counters & (cmask << cbase) &
-			   (~SBI_PMU_FIXED_CTR_MASK);
-		for_each_set_bit_from(cbase, &ctr_mask, SBI_PMU_HW_CTR_MAX) {
-			/**
-			 * Some of the platform may not support mcountinhibit.
-			 * Checking the active_events is enough for them
-			 */
-			if (active_events[hartid][cbase] != SBI_PMU_EVENT_IDX_INVALID)
-				continue;
-			/* If mcountinhibit is supported, the bit must be enabled */
-			if ((sbi_hart_priv_version(scratch) >= SBI_HART_PRIV_VER_1_11) &&
-			    !__test_bit(cbase, &mctr_inhbt))
-				continue;
-			/* We found a valid counter that is not started yet */
-			ctr_idx = cbase;
+		while ((temp = pmu_event_find_raw(data, &pos))) {
+			ctr_idx = pmu_ctr_alloc_hw(temp, cbase, cmask,
+						   mctr_inhbt, phs);
+			if (ctr_idx >= 0)
+				break;
 		}
+	} else {
+		temp = pmu_event_find_range(event_idx);
+		if (temp)
+			ctr_idx = pmu_ctr_alloc_hw(temp, cbase, cmask,
+						   mctr_inhbt, phs);
 	}
 
 	if (ctr_idx == SBI_ENOTSUPP) {
@@ -633,34 +1062,252 @@ static int pmu_ctr_find_hw(unsigned long cbase, unsigned long cmask, unsigned lo
 	return ret;
 }
 
-
 /**
  * Any firmware counter can map to any firmware event.
  * Thus, select the first available fw counter after sanity
  * check.
  */
 static int pmu_ctr_find_fw(unsigned long cbase, unsigned long cmask,
-			   uint32_t event_code, u32 hartid)
+			   uint32_t event_code,
+			   struct sbi_pmu_hart_state *phs)
 {
-	int i, cidx;
+	unsigned long fw_mask;
+	int i;
 
-	for_each_set_bit(i, &cmask, BITS_PER_LONG) {
-		cidx = i + cbase;
-		if (cidx < num_hw_ctrs || total_ctrs <= cidx)
-			continue;
-		if (active_events[hartid][i] != SBI_PMU_EVENT_IDX_INVALID)
-			continue;
-		if (SBI_PMU_FW_MAX <= event_code &&
-		    pmu_dev && pmu_dev->fw_counter_match_code) {
-			if (!pmu_dev->fw_counter_match_code(cidx - num_hw_ctrs,
-							    event_code))
-				continue;
+	/* Convert the counter mask into a mask of firmware counters */
+	if (cbase >= num_hw_ctrs)
+		fw_mask = cmask << (cbase - num_hw_ctrs);
+	else if (num_hw_ctrs - cbase < BITS_PER_LONG)
+		fw_mask = cmask >> (num_hw_ctrs - cbase);
+	else
+		fw_mask = 0;
+	fw_mask &= phs->fw_counters_free;
+
+	if (pmu_fw_event_is_dev(event_code) &&
+	    pmu_dev && pmu_dev->fw_counter_match_code) {
+		for_each_set_bit(i, &fw_mask, SBI_PMU_FW_CTR_MAX) {
+			if (pmu_dev->fw_counter_match_code(i, event_code))
+				return num_hw_ctrs + i;
 		}
+		return SBI_ENOTSUPP;
+	}
+
+	if (!fw_mask)
+		return SBI_ENOTSUPP;
+
+	return num_hw_ctrs + sbi_ffs(fw_mask);
+}
+
+static uint64_t pmu_mux_period(void)
+{
+	const struct sbi_timer_device *tdev = sbi_timer_get_device();
+
+	if (!pmu_mux_period_us || !tdev)
+		return 0;
 
-		return i;
+	return ((uint64_t)tdev->timer_freq * pmu_mux_period_us) / 1000000;
+}
+
+/* Account the time since the last update to all started counters */
+static void pmu_mux_account(struct sbi_pmu_hart_state *phs)
+{
+	struct sbi_pmu_mux_slot *slot;
+	uint64_t now = sbi_timer_value();
+	uint64_t delta = now - phs->mux_stamp;
+	int i;
+
+	phs->mux_stamp = now;
+	for_each_set_bit(i, &phs->mux_started, SBI_PMU_FW_CTR_MAX) {
+		slot = &phs->mux[i];
+		slot->time_enabled += delta;
+		if (slot->phys)
+			slot->time_running += delta;
+	}
+}
+
+static bool pmu_mux_schedule(struct sbi_pmu_hart_state *phs, int i,
+			     struct pmu_ctr_batch *batch)
+{
+	struct sbi_pmu_mux_slot *slot = &phs->mux[i];
+	int ctr_idx;
+
+	ctr_idx = pmu_ctr_find_hw(0, -1UL, slot->flags,
+				  phs->active_events[num_hw_ctrs + i],
+				  slot->data, batch);
+	/* Fixed counters are never handed over to multiplexing */
+	if (ctr_idx < 3)
+		return FALSE;
+
+	pmu_ctr_mark_free(phs, ctr_idx, FALSE);
+	slot->phys = ctr_idx;
+	pmu_ctr_start_hw_batch(batch, ctr_idx, 0, TRUE);
+
+	return TRUE;
+}
+
+/*
+ * The physical counter is read before the batch commits, so it stops
+ * contributing at the same point as the other counters of the batch.
+ */
+static void pmu_mux_unschedule(struct sbi_pmu_hart_state *phs, int i,
+			       struct pmu_ctr_batch *batch)
+{
+	struct sbi_pmu_mux_slot *slot = &phs->mux[i];
+
+	if (!slot->phys)
+		return;
+
+	pmu_ctr_stop_hw_batch(batch, slot->phys);
+	phs->fw_counters_value[i] += pmu_ctr_read_hw(slot->phys);
+	pmu_reset_hw_mhpmevent(slot->phys);
+	pmu_ctr_mark_free(phs, slot->phys, TRUE);
+	slot->phys = 0;
+}
+
+static void pmu_mux_rotate(struct sbi_pmu_hart_state *phs)
+{
+	uint64_t period = pmu_mux_period();
+	struct pmu_ctr_batch batch;
+	bool starved = FALSE;
+	int i, n;
+
+	pmu_ctr_batch_begin(&batch);
+	pmu_mux_account(phs);
+	for_each_set_bit(i, &phs->mux_started, SBI_PMU_FW_CTR_MAX)
+		pmu_mux_unschedule(phs, i, &batch);
+
+	/* Round-robin starting with the first one left out last time */
+	for (n = 0; n < SBI_PMU_FW_CTR_MAX; n++) {
+		i = (phs->mux_next + n) % SBI_PMU_FW_CTR_MAX;
+		if (!(phs->mux_started & BIT(i)) ||
+		    pmu_mux_schedule(phs, i, &batch))
+			continue;
+		if (!starved)
+			phs->mux_next = i;
+		starved = TRUE;
+	}
+	pmu_ctr_batch_commit(&batch);
+
+	/* Keep rotating only while some counter has to wait */
+	if (starved && period)
+		sbi_timer_event_add(&phs->mux_event, phs->mux_stamp + period);
+	else
+		sbi_timer_event_del(&phs->mux_event);
+}
+
+static void pmu_mux_timer(struct sbi_timer_event *ev)
+{
+	pmu_mux_rotate(ev->priv);
+}
+
+static int pmu_mux_start(struct sbi_pmu_hart_state *phs, uint32_t cidx,
+			 uint64_t ival, bool ival_update,
+			 struct pmu_ctr_batch *batch)
+{
+	struct sbi_pmu_mux_slot *slot = &phs->mux[cidx - num_hw_ctrs];
+	uint64_t period = pmu_mux_period();
+	int i = cidx - num_hw_ctrs;
+
+	if (phs->mux_started & BIT(i))
+		return SBI_EALREADY_STARTED;
+
+	pmu_mux_account(phs);
+	if (ival_update) {
+		phs->fw_counters_value[i] = ival;
+		slot->time_enabled = 0;
+		slot->time_running = 0;
+	}
+	phs->mux_started |= BIT(i);
+
+	if (!pmu_mux_schedule(phs, i, batch) && period &&
+	    !sbi_timer_event_pending(&phs->mux_event))
+		sbi_timer_event_add(&phs->mux_event, phs->mux_stamp + period);
+
+	return 0;
+}
+
+static int pmu_mux_stop(struct sbi_pmu_hart_state *phs, uint32_t cidx,
+			struct pmu_ctr_batch *batch)
+{
+	int i = cidx - num_hw_ctrs;
+
+	if (!(phs->mux_started & BIT(i)))
+		return SBI_EALREADY_STOPPED;
+
+	pmu_mux_account(phs);
+	pmu_mux_unschedule(phs, i, batch);
+	phs->mux_started &= ~BIT(i);
+
+	return 0;
+}
+
+static uint64_t pmu_mux_read(struct sbi_pmu_hart_state *phs, uint32_t cidx)
+{
+	struct sbi_pmu_mux_slot *slot = &phs->mux[cidx - num_hw_ctrs];
+	uint64_t value = phs->fw_counters_value[cidx - num_hw_ctrs];
+	uint64_t enabled, running;
+
+	if (slot->phys) {
+		pmu_mux_account(phs);
+		value += pmu_ctr_read_hw(slot->phys);
 	}
 
-	return SBI_ENOTSUPP;
+	/* Scale up the count by the fraction of time it was counted */
+	enabled = slot->time_enabled;
+	running = slot->time_running;
+	if (!running || running >= enabled)
+		return value;
+
+	return (value / running) * enabled +
+	       ((value % running) * enabled) / running;
+}
+
+/* Give a firmware counter to an event no hardware counter is free for */
+static int pmu_mux_alloc(unsigned long cbase, unsigned long cmask,
+			 unsigned long flags, unsigned long event_idx,
+			 uint64_t data, struct sbi_pmu_hart_state *phs)
+{
+	struct sbi_pmu_mux_slot *slot;
+	uint32_t pos = 0;
+	int ctr_idx, i;
+
+	if (!pmu_mux_period())
+		return SBI_ENOTSUPP;
+
+	/* The event must be countable by some hardware counter */
+	if (event_idx == SBI_PMU_EVENT_RAW_IDX) {
+		if (!pmu_event_find_raw(data, &pos))
+			return SBI_ENOTSUPP;
+	} else if (!pmu_event_find_range(event_idx)) {
+		return SBI_ENOTSUPP;
+	}
+
+	/* Don't let platform specific firmware counters veto the match */
+	ctr_idx = pmu_ctr_find_fw(cbase, cmask, 0, phs);
+	if (ctr_idx < 0)
+		return ctr_idx;
+
+	i = ctr_idx - num_hw_ctrs;
+	slot = &phs->mux[i];
+	slot->data = data;
+	slot->flags = flags;
+	slot->time_enabled = 0;
+	slot->time_running = 0;
+	slot->phys = 0;
+	phs->fw_counters_value[i] = 0;
+	phs->mux_counters |= BIT(i);
+
+	return ctr_idx;
+}
+
+int sbi_pmu_set_mux_period(unsigned long usecs)
+{
+	if (usecs > SBI_PMU_MUX_PERIOD_MAX_US)
+		return SBI_EINVAL;
+
+	pmu_mux_period_us = usecs;
+
+	return 0;
 }
 
 int sbi_pmu_ctr_cfg_match(unsigned long cidx_base, unsigned long cidx_mask,
@@ -668,7 +1315,9 @@ int sbi_pmu_ctr_cfg_match(unsigned long cidx_base, unsigned long cidx_mask,
 			  uint64_t event_data)
 {
 	int ret, ctr_idx = SBI_ENOTSUPP;
-	u32 event_code, hartid = current_hartid();
+	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
+	struct pmu_ctr_batch batch;
+	u32 event_code;
 	int event_type;
 
 	/* Do a basic sanity check of counter base & mask */
@@ -685,71 +1334,298 @@ int sbi_pmu_ctr_cfg_match(unsigned long cidx_base, unsigned long cidx_mask,
 		 * counter idx for the given event. Verify that the counter idx
 		 * is still valid.
 		 */
-		if (active_events[hartid][cidx_base] == SBI_PMU_EVENT_IDX_INVALID)
+		if (phs->active_events[cidx_base] == SBI_PMU_EVENT_IDX_INVALID)
 			return SBI_EINVAL;
 		ctr_idx = cidx_base;
 		goto skip_match;
 	}
 
 	if (event_type == SBI_PMU_EVENT_TYPE_FW) {
+		if (event_code == SBI_PMU_FW_PLATFORM &&
+		    event_data >= SBI_PMU_FW_OPENSBI_MAX)
+			return SBI_EINVAL;
 		/* Any firmware counter can be used track any firmware event */
-		ctr_idx = pmu_ctr_find_fw(cidx_base, cidx_mask, event_code, hartid);
+		ctr_idx = pmu_ctr_find_fw(cidx_base, cidx_mask, event_code, phs);
+		if (ctr_idx >= 0 && event_code == SBI_PMU_FW_PLATFORM)
+			phs->fw_counters_data[ctr_idx - num_hw_ctrs] = event_data;
 	} else {
 		ctr_idx = pmu_ctr_find_hw(cidx_base, cidx_mask, flags, event_idx,
-					  event_data);
+					  event_data, NULL);
+		/* Fall back to time-slicing the event on a firmware counter */
+		if (ctr_idx < 0)
+			ctr_idx = pmu_mux_alloc(cidx_base, cidx_mask, flags,
+						event_idx, event_data, phs);
 	}
 
 	if (ctr_idx < 0)
 		return SBI_ENOTSUPP;
 
-	active_events[hartid][ctr_idx] = event_idx;
+	phs->active_events[ctr_idx] = event_idx;
+	pmu_ctr_mark_free(phs, ctr_idx, FALSE);
 skip_match:
-	if (event_type == SBI_PMU_EVENT_TYPE_HW) {
+	if (pmu_ctr_is_mux(phs, ctr_idx)) {
+		if (flags & SBI_PMU_CFG_FLAG_CLEAR_VALUE)
+			phs->fw_counters_value[ctr_idx - num_hw_ctrs] = 0;
+		if (flags & SBI_PMU_CFG_FLAG_AUTO_START) {
+			pmu_ctr_batch_begin(&batch);
+			pmu_mux_start(phs, ctr_idx, 0, FALSE, &batch);
+			pmu_ctr_batch_commit(&batch);
+		}
+	} else if (event_type == SBI_PMU_EVENT_TYPE_HW) {
 		if (flags & SBI_PMU_CFG_FLAG_CLEAR_VALUE)
 			pmu_ctr_write_hw(ctr_idx, 0);
 		if (flags & SBI_PMU_CFG_FLAG_AUTO_START)
 			pmu_ctr_start_hw(ctr_idx, 0, false);
 	} else if (event_type == SBI_PMU_EVENT_TYPE_FW) {
 		if (flags & SBI_PMU_CFG_FLAG_CLEAR_VALUE)
-			fw_counters_value[hartid][ctr_idx - num_hw_ctrs] = 0;
+			phs->fw_counters_value[ctr_idx - num_hw_ctrs] = 0;
 		if (flags & SBI_PMU_CFG_FLAG_AUTO_START) {
-			if (SBI_PMU_FW_MAX <= event_code &&
+			if (pmu_fw_event_is_dev(event_code) &&
 			    pmu_dev && pmu_dev->fw_counter_start) {
 				ret = pmu_dev->fw_counter_start(
 					ctr_idx - num_hw_ctrs, event_code,
-					fw_counters_value[hartid][ctr_idx - num_hw_ctrs],
+					phs->fw_counters_value[ctr_idx - num_hw_ctrs],
 					true);
 				if (ret)
 					return ret;
 			}
-			fw_counters_started[hartid] |= BIT(ctr_idx - num_hw_ctrs);
+			phs->fw_counters_overflow &= ~BIT(ctr_idx - num_hw_ctrs);
+			phs->fw_counters_started |= BIT(ctr_idx - num_hw_ctrs);
 		}
 	}
 
 	return ctr_idx;
 }
 
-int sbi_pmu_ctr_incr_fw(enum sbi_pmu_fw_event_code_id fw_id)
+static void pmu_ctr_overflow_fw(struct sbi_pmu_hart_state *phs,
+				uint32_t cidx)
+{
+	unsigned long irq_bit;
+
+	/* Only one interrupt per overflow until the counter is restarted */
+	if (phs->fw_counters_overflow & BIT(cidx - num_hw_ctrs))
+		return;
+	phs->fw_counters_overflow |= BIT(cidx - num_hw_ctrs);
+
+	/*
+	 * Raise the same counter overflow interrupt as the hardware
+	 * counters so that S-mode can sample firmware events too.
+	 */
+	irq_bit = sbi_pmu_irq_bit();
+	if (irq_bit)
+		csr_set(CSR_MIP, irq_bit);
+}
+
+void sbi_pmu_set_trap_virt(bool virt)
+{
+	struct sbi_pmu_hart_state *phs;
+
+	if (unlikely(!phs_ptr_offset))
+		return;
+
+	phs = pmu_thishart_state_ptr();
+	phs->trap_virt = virt;
+}
+
+static unsigned long pmu_vmid_max(void)
 {
-	u32 cidx, hartid = current_hartid();
-	uint64_t *fcounter = NULL;
+#if __riscv_xlen == 32
+	return HGATP32_VMID_MASK >> HGATP32_VMID_SHIFT;
+#else
+	return HGATP64_VMID_MASK >> HGATP64_VMID_SHIFT;
+#endif
+}
+
+static unsigned long pmu_current_vmid(void)
+{
+#if __riscv_xlen == 32
+	return (csr_read(CSR_HGATP) & HGATP32_VMID_MASK) >> HGATP32_VMID_SHIFT;
+#else
+	return (csr_read(CSR_HGATP) & HGATP64_VMID_MASK) >> HGATP64_VMID_SHIFT;
+#endif
+}
 
-	if (likely(!fw_counters_started[hartid]))
+static struct sbi_pmu_vmid_bank *pmu_vmid_bank_find(
+					struct sbi_pmu_hart_state *phs,
+					unsigned long vmid, bool alloc)
+{
+	int i;
+	struct sbi_pmu_vmid_bank *bank, *unused = NULL;
+
+	for (i = 0; i < SBI_PMU_VMID_BANK_MAX; i++) {
+		bank = &phs->vmid_banks[i];
+		if (bank->used && bank->vmid == vmid)
+			return bank;
+		if (!bank->used && !unused)
+			unused = bank;
+	}
+
+	if (!alloc || !unused)
+		return NULL;
+
+	sbi_memset(unused->values, 0, sizeof(unused->values));
+	unused->vmid = vmid;
+	unused->used = TRUE;
+
+	return unused;
+}
+
+int sbi_pmu_vmid_read(unsigned long vmid, uint32_t cidx,
+		      unsigned long flags, uint64_t *cval)
+{
+	int event_idx_type;
+	uint32_t event_code;
+	struct sbi_pmu_vmid_bank *bank;
+	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
+
+	if (flags & ~SBI_OPENSBI_PMU_VMID_READ_FLAG_RESET)
+		return SBI_EINVAL;
+	if (vmid > pmu_vmid_max())
+		return SBI_EINVAL;
+
+	/* Only firmware events are counted on behalf of guests */
+	event_idx_type = pmu_ctr_validate(cidx, &event_code);
+	if (event_idx_type != SBI_PMU_EVENT_TYPE_FW ||
+	    pmu_ctr_is_mux(phs, cidx) || pmu_fw_event_is_dev(event_code))
+		return SBI_EINVAL;
+
+	bank = pmu_vmid_bank_find(phs, vmid, FALSE);
+	if (!bank) {
+		*cval = 0;
 		return 0;
+	}
 
-	if (unlikely(fw_id >= SBI_PMU_FW_MAX))
+	*cval = bank->values[cidx - num_hw_ctrs];
+	if (flags & SBI_OPENSBI_PMU_VMID_READ_FLAG_RESET)
+		bank->values[cidx - num_hw_ctrs] = 0;
+
+	return 0;
+}
+
+int sbi_pmu_vmid_release(unsigned long vmid)
+{
+	struct sbi_pmu_vmid_bank *bank;
+	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
+
+	if (vmid > pmu_vmid_max())
 		return SBI_EINVAL;
 
+	bank = pmu_vmid_bank_find(phs, vmid, FALSE);
+	if (bank)
+		bank->used = FALSE;
+
+	return 0;
+}
+
+/*
+ * Add a value to the started firmware counter of an event. The data is
+ * only compared for the OpenSBI events behind SBI_PMU_FW_PLATFORM.
+ */
+static void pmu_ctr_add_fw(struct sbi_pmu_hart_state *phs,
+			   uint32_t event_code, uint32_t data, uint64_t val)
+{
+	struct sbi_pmu_vmid_bank *bank;
+	u32 cidx;
+	uint64_t *fcounter = NULL, prev;
+
 	for (cidx = num_hw_ctrs; cidx < total_ctrs; cidx++) {
-		if (get_cidx_code(active_events[hartid][cidx]) == fw_id &&
-		    (fw_counters_started[hartid] & BIT(cidx - num_hw_ctrs))) {
-			fcounter = &fw_counters_value[hartid][cidx - num_hw_ctrs];
+		if (get_cidx_code(phs->active_events[cidx]) == event_code &&
+		    (phs->fw_counters_started & BIT(cidx - num_hw_ctrs)) &&
+		    (event_code != SBI_PMU_FW_PLATFORM ||
+		     phs->fw_counters_data[cidx - num_hw_ctrs] == data)) {
+			fcounter = &phs->fw_counters_value[cidx - num_hw_ctrs];
 			break;
 		}
 	}
 
-	if (fcounter)
-		(*fcounter)++;
+	if (!fcounter)
+		return;
+
+	prev = *fcounter;
+	*fcounter += val;
+	if (*fcounter < prev)
+		pmu_ctr_overflow_fw(phs, cidx);
+
+	/*
+	 * The host total keeps counting everything while the guest
+	 * share goes to the bank of the VMID the trap came from. Once
+	 * all banks are taken further guests are only in the total.
+	 */
+	if (phs->trap_virt) {
+		bank = pmu_vmid_bank_find(phs, pmu_current_vmid(), TRUE);
+		if (bank)
+			bank->values[cidx - num_hw_ctrs] += val;
+	}
+}
+
+int sbi_pmu_ctr_incr_fw(enum sbi_pmu_fw_event_code_id fw_id)
+{
+	struct sbi_pmu_hart_state *phs;
+
+	/* Traps may happen before the PMU is initialized */
+	if (unlikely(!phs_ptr_offset))
+		return 0;
+
+	phs = pmu_thishart_state_ptr();
+	if (likely(!phs->fw_counters_started))
+		return 0;
+
+	if (unlikely(fw_id >= SBI_PMU_FW_MAX))
+		return SBI_EINVAL;
+
+	pmu_ctr_add_fw(phs, fw_id, 0, 1);
+
+	return 0;
+}
+
+int sbi_pmu_ctr_add_opensbi_fw(enum sbi_pmu_fw_opensbi_event_id id,
+			       uint64_t val)
+{
+	struct sbi_pmu_hart_state *phs;
+
+	if (unlikely(!phs_ptr_offset))
+		return 0;
+
+	phs = pmu_thishart_state_ptr();
+	if (likely(!phs->fw_counters_started))
+		return 0;
+
+	if (unlikely(id >= SBI_PMU_FW_OPENSBI_MAX))
+		return SBI_EINVAL;
+
+	pmu_ctr_add_fw(phs, SBI_PMU_FW_PLATFORM, id, val);
+
+	return 0;
+}
+
+int sbi_pmu_ctr_incr_opensbi_fw(enum sbi_pmu_fw_opensbi_event_id id)
+{
+	return sbi_pmu_ctr_add_opensbi_fw(id, 1);
+}
+
+int sbi_pmu_snapshot_set_shmem(unsigned long shmem_lo,
+			       unsigned long shmem_hi,
+			       unsigned long flags)
+{
+	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
+
+	if (flags)
+		return SBI_EINVAL;
+
+	/* All ones disables the snapshot */
+	if (shmem_lo == -1UL && shmem_hi == -1UL) {
+		phs->snapshot = NULL;
+		return 0;
+	}
+
+	if (shmem_hi || (shmem_lo & (SBI_PMU_SNAPSHOT_SIZE - 1)))
+		return SBI_EINVALID_ADDR;
+	if (!sbi_domain_check_addr_range(sbi_domain_thishart_ptr(), shmem_lo,
+					 SBI_PMU_SNAPSHOT_SIZE, PRV_S,
+					 SBI_DOMAIN_READ | SBI_DOMAIN_WRITE))
+		return SBI_EINVALID_ADDR;
+
+	phs->snapshot = (struct sbi_pmu_snapshot *)shmem_lo;
 
 	return 0;
 }
@@ -789,16 +1665,25 @@ int sbi_pmu_ctr_get_info(uint32_t cidx, unsigned long *ctr_info)
 	return 0;
 }
 
-static void pmu_reset_event_map(u32 hartid)
+static void pmu_reset_event_map(struct sbi_pmu_hart_state *phs)
 {
 	int j;
 
 	/* Initialize the counter to event mapping table */
 	for (j = 3; j < total_ctrs; j++)
-		active_events[hartid][j] = SBI_PMU_EVENT_IDX_INVALID;
+		phs->active_events[j] = SBI_PMU_EVENT_IDX_INVALID;
 	for (j = 0; j < SBI_PMU_FW_CTR_MAX; j++)
-		fw_counters_value[hartid][j] = 0;
-	fw_counters_started[hartid] = 0;
+		phs->fw_counters_value[j] = 0;
+	phs->fw_counters_started = 0;
+	phs->fw_counters_overflow = 0;
+	phs->mux_counters = 0;
+	phs->mux_started = 0;
+	phs->mux_next = 0;
+	phs->hw_counters_free = (num_hw_ctrs > 3) ?
+				GENMASK(num_hw_ctrs - 1, 3) : 0;
+	phs->fw_counters_free = GENMASK(SBI_PMU_FW_CTR_MAX - 1, 0);
+	for (j = 0; j < SBI_PMU_VMID_BANK_MAX; j++)
+		phs->vmid_banks[j].used = FALSE;
 }
 
 const struct sbi_pmu_device *sbi_pmu_get_device(void)
@@ -816,22 +1701,30 @@ void sbi_pmu_set_device(const struct sbi_pmu_device *dev)
 
 void sbi_pmu_exit(struct sbi_scratch *scratch)
 {
-	u32 hartid = current_hartid();
+	struct sbi_pmu_hart_state *phs = pmu_get_hart_state_ptr(scratch);
 
 	if (sbi_hart_priv_version(scratch) >= SBI_HART_PRIV_VER_1_11)
 		csr_write(CSR_MCOUNTINHIBIT, 0xFFFFFFF8);
 
 	if (sbi_hart_priv_version(scratch) >= SBI_HART_PRIV_VER_1_10)
 		csr_write(CSR_MCOUNTEREN, -1);
-	pmu_reset_event_map(hartid);
+	sbi_timer_event_del(&phs->mux_event);
+	pmu_reset_event_map(phs);
+	phs->snapshot = NULL;
 }
 
 int sbi_pmu_init(struct sbi_scratch *scratch, bool cold_boot)
 {
 	const struct sbi_platform *plat;
-	u32 hartid = current_hartid();
+	struct sbi_pmu_hart_state *phs;
 
 	if (cold_boot) {
+		phs_ptr_offset = sbi_scratch_alloc_aligned_offset(
+					sizeof(*phs),
+					SBI_SCRATCH_CACHE_LINE_SIZE);
+		if (!phs_ptr_offset)
+			return SBI_ENOMEM;
+
 		plat = sbi_platform_ptr(scratch);
 		/* Initialize hw pmu events */
 		sbi_platform_pmu_init(plat);
@@ -839,16 +1732,23 @@ int sbi_pmu_init(struct sbi_scratch *scratch, bool cold_boot)
 		/* mcycle & minstret is available always */
 		num_hw_ctrs = sbi_hart_mhpm_count(scratch) + 3;
 		total_ctrs = num_hw_ctrs + SBI_PMU_FW_CTR_MAX;
+	} else {
+		if (!phs_ptr_offset)
+			return SBI_ENOMEM;
 	}
 
-	pmu_reset_event_map(hartid);
+	phs = pmu_get_hart_state_ptr(scratch);
+	pmu_reset_event_map(phs);
+	phs->snapshot = NULL;
+	phs->mux_event.handler = pmu_mux_timer;
+	phs->mux_event.priv = phs;
 
 	/* First three counters are fixed by the priv spec and we enable it by default */
-	active_events[hartid][0] = SBI_PMU_EVENT_TYPE_HW << SBI_PMU_EVENT_IDX_OFFSET |
-				   SBI_PMU_HW_CPU_CYCLES;
-	active_events[hartid][1] = SBI_PMU_EVENT_IDX_INVALID;
-	active_events[hartid][2] = SBI_PMU_EVENT_TYPE_HW << SBI_PMU_EVENT_IDX_OFFSET |
-				   SBI_PMU_HW_INSTRUCTIONS;
+	phs->active_events[0] = SBI_PMU_EVENT_TYPE_HW << SBI_PMU_EVENT_IDX_OFFSET |
+				SBI_PMU_HW_CPU_CYCLES;
+	phs->active_events[1] = SBI_PMU_EVENT_IDX_INVALID;
+	phs->active_events[2] = SBI_PMU_EVENT_TYPE_HW << SBI_PMU_EVENT_IDX_OFFSET |
+				SBI_PMU_HW_INSTRUCTIONS;
 
 	return 0;
 }
@@ -41,10 +41,16 @@ int sbi_scratch_init(struct sbi_scratch *scratch)
 }
 
 unsigned long sbi_scratch_alloc_offset(unsigned long size)
+{
+	return sbi_scratch_alloc_aligned_offset(size, __SIZEOF_POINTER__);
+}
+
+unsigned long sbi_scratch_alloc_aligned_offset(unsigned long size,
+					       unsigned long align)
 {
 	u32 i;
 	void *ptr;
-	unsigned long ret = 0;
+	unsigned long ret = 0, offset;
 	struct sbi_scratch *rscratch;
 
 	/*
@@ -56,19 +62,22 @@ unsigned long sbi_scratch_alloc_offset(unsigned long size)
 	 * will allow us to re-claim free-ed space.
 	 */
 
-	if (!size)
+	if (!size || !align || (align & (align - 1)))
 		return 0;
 
-	if (size & (__SIZEOF_POINTER__ - 1))
-		size = (size & ~(__SIZEOF_POINTER__ - 1)) + __SIZEOF_POINTER__;
+	if (align < __SIZEOF_POINTER__)
+		align = __SIZEOF_POINTER__;
+	if (size & (align - 1))
+		size = (size & ~(align - 1)) + align;
 
 	spin_lock(&extra_lock);
 
-	if (SBI_SCRATCH_SIZE < (extra_offset + size))
+	offset = (extra_offset + align - 1) & ~(align - 1);
+	if (SBI_SCRATCH_SIZE < (offset + size))
 		goto done;
 
-	ret = extra_offset;
-	extra_offset += size;
+	ret = offset;
+	extra_offset = offset + size;
 
 done:
 	spin_unlock(&extra_lock);
@@ -16,11 +16,208 @@
 #include <sbi/sbi_platform.h>
 #include <sbi/sbi_pmu.h>
 #include <sbi/sbi_scratch.h>
+#include <sbi/sbi_string.h>
 #include <sbi/sbi_timer.h>
 
+/* Maximum number of firmware timer events queued on one HART */
+#define SBI_TIMER_EVENT_MAX		16
+
+/* Maximum timer slack in microseconds */
+#define SBI_TIMER_SLACK_MAX_US		10000
+
+/* Shorter delays are polled because arming a timer event costs more */
+#define SBI_TIMER_SLEEP_MIN_US		20
+
+/* Interval at which sbi_timer_waitms_until() checks its predicate */
+#define SBI_TIMER_WAIT_TICK_US		100
+
+struct sbi_timer_hart {
+	/* Deadline of S-mode, queued only when Sstc is not available */
+	struct sbi_timer_event smode;
+	/* Deadline programmed into the timer device, -1ULL if none */
+	u64 programmed;
+	/* Defer reprogramming while expired events are handled */
+	bool processing;
+	/* Timer device of this HART is set up */
+	bool ready;
+	/* Number of queued events with SBI_TIMER_EVENT_EXACT */
+	u32 exact;
+	/* Min-heap of queued events ordered by deadline */
+	u32 count;
+	struct sbi_timer_event *heap[SBI_TIMER_EVENT_MAX + 1];
+};
+
 static unsigned long time_delta_off;
+static unsigned long timer_hart_off;
 static u64 (*get_time_val)(void);
 static const struct sbi_timer_device *timer_dev = NULL;
+static ulong timer_slack_us;
+/* At most SBI_TIMER_SLACK_MAX_US worth of ticks so it fits in a ulong */
+static ulong timer_slack;
+
+static inline struct sbi_timer_hart *timer_thishart(void)
+{
+	return sbi_scratch_thishart_offset_ptr(timer_hart_off);
+}
+
+static void timer_heap_swap(struct sbi_timer_hart *th, u32 i, u32 j)
+{
+	struct sbi_timer_event *ev = th->heap[i];
+
+	th->heap[i] = th->heap[j];
+	th->heap[j] = ev;
+	th->heap[i]->index = i + 1;
+	th->heap[j]->index = j + 1;
+}
+
+static void timer_heap_up(struct sbi_timer_hart *th, u32 i)
+{
+	u32 parent;
+
+	while (i) {
+		parent = (i - 1) / 2;
+		if (th->heap[parent]->time <= th->heap[i]->time)
+			break;
+		timer_heap_swap(th, i, parent);
+		i = parent;
+	}
+}
+
+static void timer_heap_down(struct sbi_timer_hart *th, u32 i)
+{
+	u32 child, min;
+
+	while (1) {
+		min = i;
+		child = 2 * i + 1;
+		if (child < th->count &&
+		    th->heap[child]->time < th->heap[min]->time)
+			min = child;
+		child++;
+		if (child < th->count &&
+		    th->heap[child]->time < th->heap[min]->time)
+			min = child;
+		if (min == i)
+			break;
+		timer_heap_swap(th, i, min);
+		i = min;
+	}
+}
+
+static void timer_heap_remove(struct sbi_timer_hart *th,
+			      struct sbi_timer_event *ev)
+{
+	u32 i = ev->index - 1;
+
+	if (ev->flags & SBI_TIMER_EVENT_EXACT)
+		th->exact--;
+	th->count--;
+	if (i != th->count) {
+		th->heap[i] = th->heap[th->count];
+		th->heap[i]->index = i + 1;
+		timer_heap_up(th, i);
+		timer_heap_down(th, th->heap[i]->index - 1);
+	}
+	ev->index = 0;
+}
+
+/* Program the timer device with the earliest deadline if it changed */
+static void timer_queue_program(struct sbi_timer_hart *th)
+{
+	ulong slack = (th->exact) ? 0 : timer_slack;
+	u64 next;
+
+	if (th->processing)
+		return;
+
+	if (!th->count) {
+		csr_clear(CSR_MIE, MIP_MTIP);
+		th->programmed = -1ULL;
+		return;
+	}
+
+	/*
+	 * A deadline already programmed within the slack window of the
+	 * earliest event is good enough. Otherwise program the end of the
+	 * window so that later events inside it share the interrupt. No
+	 * slack is applied while an exact event is queued.
+	 */
+	next = th->heap[0]->time;
+	if (next <= th->programmed && th->programmed - next <= slack) {
+		if (next != th->programmed)
+			sbi_pmu_ctr_incr_opensbi_fw(
+				SBI_PMU_FW_OPENSBI_TIMER_SKIPPED);
+	} else {
+		if (next + slack > next)
+			next += slack;
+		timer_dev->timer_event_start(next);
+		th->programmed = next;
+	}
+	csr_set(CSR_MIE, MIP_MTIP);
+}
+
+int sbi_timer_set_slack(ulong usecs)
+{
+	if (!timer_dev)
+		return SBI_ENODEV;
+	if (usecs > SBI_TIMER_SLACK_MAX_US)
+		return SBI_EINVAL;
+
+	timer_slack_us = usecs;
+	timer_slack = ((u64)timer_dev->timer_freq * usecs) / 1000000;
+
+	return 0;
+}
+
+ulong sbi_timer_get_slack(void)
+{
+	return timer_slack_us;
+}
+
+int sbi_timer_event_add(struct sbi_timer_event *ev, u64 time)
+{
+	struct sbi_timer_hart *th = timer_thishart();
+
+	if (!ev || !ev->handler)
+		return SBI_EINVAL;
+	if (!timer_dev || !timer_dev->timer_event_start)
+		return SBI_ENODEV;
+
+	ev->time = time;
+	if (ev->index) {
+		timer_heap_up(th, ev->index - 1);
+		timer_heap_down(th, ev->index - 1);
+	} else {
+		/* The last slot is reserved for the S-mode deadline */
+		if (th->count >= SBI_TIMER_EVENT_MAX && ev != &th->smode)
+			return SBI_ENOSPC;
+		th->heap[th->count] = ev;
+		ev->index = ++th->count;
+		if (ev->flags & SBI_TIMER_EVENT_EXACT)
+			th->exact++;
+		timer_heap_up(th, ev->index - 1);
+	}
+
+	timer_queue_program(th);
+
+	return 0;
+}
+
+void sbi_timer_event_del(struct sbi_timer_event *ev)
+{
+	struct sbi_timer_hart *th = timer_thishart();
+
+	if (!ev || !ev->index)
+		return;
+
+	timer_heap_remove(th, ev);
+	timer_queue_program(th);
+}
+
+static void timer_smode_handler(struct sbi_timer_event *ev)
+{
+	csr_set(CSR_MIP, MIP_STIP);
+}
 
 #if __riscv_xlen == 32
 static u64 get_ticks(void)
@@ -44,9 +241,48 @@ static u64 get_ticks(void)
 }
 #endif
 
-static void nop_delay_fn(void *opaque)
+static void timer_sleep_event(struct sbi_timer_event *ev)
 {
-	cpu_relax();
+}
+
+/* Wait until delta ticks have passed since start */
+static void timer_sleep(u64 start, u64 delta)
+{
+	struct sbi_timer_hart *th = NULL;
+	struct sbi_timer_event ev = {
+		.handler = timer_sleep_event,
+		.flags = SBI_TIMER_EVENT_EXACT,
+	};
+
+	if (!get_time_val)
+		return;
+	if (timer_hart_off)
+		th = sbi_scratch_thishart_offset_ptr(timer_hart_off);
+
+	/*
+	 * Sleep in WFI until the timer event is due. WFI wakes up on
+	 * pending interrupts enabled in MIE even though M-mode runs with
+	 * interrupts globally disabled. Poll instead for short delays,
+	 * before the timer of this HART is set up and from timer event
+	 * handlers where the deadline can't be programmed.
+	 */
+	if (!th || !th->ready || th->processing ||
+	    delta < ((u64)timer_dev->timer_freq * SBI_TIMER_SLEEP_MIN_US) /
+		    1000000 ||
+	    sbi_timer_event_add(&ev, start + delta)) {
+		while ((get_time_val() - start) < delta)
+			cpu_relax();
+		return;
+	}
+
+	while ((get_time_val() - start) < delta) {
+		wfi();
+		/* Handle other deadlines which expired meanwhile */
+		if (csr_read(CSR_MIP) & MIP_MTIP)
+			sbi_timer_process();
+	}
+
+	sbi_timer_event_del(&ev);
 }
 
 void sbi_timer_delay_loop(ulong units, u64 unit_freq,
@@ -67,9 +303,11 @@ void sbi_timer_delay_loop(ulong units, u64 unit_freq,
 	delta = ((u64)timer_dev->timer_freq * (u64)units);
 	delta = delta / unit_freq;
 
-	/* Use NOP delay function if delay function not available */
-	if (!delay_fn)
-		delay_fn = nop_delay_fn;
+	/* Sleep if the caller doesn't need its own delay function */
+	if (!delay_fn) {
+		timer_sleep(start_val, delta);
+		return;
+	}
 
 	/* Busy loop until desired timer value delta reached */
 	while ((get_time_val() - start_val) < delta)
@@ -83,9 +321,19 @@ bool sbi_timer_waitms_until(bool (*predicate)(void *), void *arg,
 	uint64_t ticks =
 		(sbi_timer_get_device()->timer_freq / 1000) *
 		timeout_ms;
-	while(!predicate(arg))
-		if (sbi_timer_value() - start_time  >= ticks)
+	uint64_t tick =
+		((uint64_t)sbi_timer_get_device()->timer_freq *
+		 SBI_TIMER_WAIT_TICK_US) / 1000000;
+	uint64_t now, delta;
+
+	/* Check the predicate once per tick instead of in a tight loop */
+	while(!predicate(arg)) {
+		now = sbi_timer_value();
+		if (now - start_time >= ticks)
 			return false;
+		delta = ticks - (now - start_time);
+		timer_sleep(now, (delta < tick) ? delta : tick);
+	}
 	return true;
 }
 
@@ -129,8 +377,15 @@ void sbi_timer_set_delta_upper(ulong delta_upper)
 	*time_delta |= ((u64)delta_upper << 32);
 }
 
+u64 sbi_timer_get_cmp(void)
+{
+	return timer_thishart()->smode.time;
+}
+
 void sbi_timer_event_start(u64 next_event)
 {
+	struct sbi_timer_hart *th = timer_thishart();
+
 	sbi_pmu_ctr_incr_fw(SBI_PMU_FW_SET_TIMER);
 
 	/**
@@ -138,6 +393,7 @@ void sbi_timer_event_start(u64 next_event)
 	 * the older software to leverage sstc extension on newer hardware.
 	 */
 	if (sbi_hart_has_extension(sbi_scratch_thishart_ptr(), SBI_HART_EXT_SSTC)) {
+		th->smode.time = next_event;
 #if __riscv_xlen == 32
 		csr_write(CSR_STIMECMP, next_event & 0xFFFFFFFF);
 		csr_write(CSR_STIMECMPH, next_event >> 32);
@@ -145,22 +401,37 @@ void sbi_timer_event_start(u64 next_event)
 		csr_write(CSR_STIMECMP, next_event);
 #endif
 	} else if (timer_dev && timer_dev->timer_event_start) {
-		timer_dev->timer_event_start(next_event);
+		/* S-mode disables its timer by asking for the last tick */
+		if (next_event == -1ULL) {
+			th->smode.time = next_event;
+			sbi_timer_event_del(&th->smode);
+		} else {
+			sbi_timer_event_add(&th->smode, next_event);
+		}
 		csr_clear(CSR_MIP, MIP_STIP);
 	}
-	csr_set(CSR_MIE, MIP_MTIP);
 }
 
 void sbi_timer_process(void)
 {
-	csr_clear(CSR_MIE, MIP_MTIP);
+	struct sbi_timer_event *ev;
+	struct sbi_timer_hart *th = timer_thishart();
+	u64 now = sbi_timer_value();
+
 	/*
-	 * If sstc extension is available, supervisor can receive the timer
-	 * directly without M-mode come in between. This function should
-	 * only invoked if M-mode programs the timer for its own purpose.
+	 * Run the handlers of all expired events. With Sstc the S-mode
+	 * deadline is never queued, so the supervisor only gets STIP
+	 * from here when its own deadline expired.
 	 */
-	if (!sbi_hart_has_extension(sbi_scratch_thishart_ptr(), SBI_HART_EXT_SSTC))
-		csr_set(CSR_MIP, MIP_STIP);
+	th->processing = true;
+	while (th->count && th->heap[0]->time <= now) {
+		ev = th->heap[0];
+		timer_heap_remove(th, ev);
+		ev->handler(ev);
+	}
+	th->processing = false;
+
+	timer_queue_program(th);
 }
 
 const struct sbi_timer_device *sbi_timer_get_device(void)
@@ -180,7 +451,10 @@ void sbi_timer_set_device(const struct sbi_timer_device *dev)
 
 int sbi_timer_init(struct sbi_scratch *scratch, bool cold_boot)
 {
+	u32 i;
+	int rc;
 	u64 *time_delta;
+	struct sbi_timer_hart *th;
 	const struct sbi_platform *plat = sbi_platform_ptr(scratch);
 
 	if (cold_boot) {
@@ -188,26 +462,50 @@ int sbi_timer_init(struct sbi_scratch *scratch, bool cold_boot)
 		if (!time_delta_off)
 			return SBI_ENOMEM;
 
+		timer_hart_off = sbi_scratch_alloc_offset(sizeof(*th));
+		if (!timer_hart_off)
+			return SBI_ENOMEM;
+
 		if (sbi_hart_has_extension(scratch, SBI_HART_EXT_TIME))
 			get_time_val = get_ticks;
 	} else {
-		if (!time_delta_off)
+		if (!time_delta_off || !timer_hart_off)
 			return SBI_ENOMEM;
 	}
 
 	time_delta = sbi_scratch_offset_ptr(scratch, time_delta_off);
 	*time_delta = 0;
 
-	return sbi_platform_timer_init(plat, cold_boot);
+	/* Events queued before this HART was stopped are dropped */
+	th = sbi_scratch_offset_ptr(scratch, timer_hart_off);
+	for (i = 0; i < th->count; i++)
+		th->heap[i]->index = 0;
+	sbi_memset(th, 0, sizeof(*th));
+	th->smode.time = -1ULL;
+	th->smode.handler = timer_smode_handler;
+	th->programmed = -1ULL;
+
+	rc = sbi_platform_timer_init(plat, cold_boot);
+	if (rc)
+		return rc;
+
+	th->ready = true;
+
+	return 0;
 }
 
 void sbi_timer_exit(struct sbi_scratch *scratch)
 {
+	struct sbi_timer_hart *th = sbi_scratch_offset_ptr(scratch,
+							   timer_hart_off);
+
 	if (timer_dev && timer_dev->timer_event_stop)
 		timer_dev->timer_event_stop();
 
 	csr_clear(CSR_MIP, MIP_STIP);
 	csr_clear(CSR_MIE, MIP_MTIP);
+	th->programmed = -1ULL;
+	th->ready = false;
 
 	sbi_platform_timer_exit(sbi_platform_ptr(scratch));
 }
@@ -13,6 +13,7 @@
 #include <sbi/sbi_console.h>
 #include <sbi/sbi_ecall.h>
 #include <sbi/sbi_error.h>
+#include <sbi/sbi_extable.h>
 #include <sbi/sbi_hart.h>
 #include <sbi/sbi_illegal_insn.h>
 #include <sbi/sbi_ipi.h>
@@ -244,6 +245,17 @@ static int sbi_trap_aia_irq(struct sbi_trap_regs *regs, ulong mcause)
 	return 0;
 }
 
+/* Account M-mode cycles of a trap to the residency firmware events */
+static void sbi_trap_residency(ulong mcycle_start,
+			       enum sbi_pmu_fw_opensbi_event_id category)
+{
+	ulong mcycles = csr_read(CSR_MCYCLE) - mcycle_start;
+
+	sbi_pmu_ctr_add_opensbi_fw(SBI_PMU_FW_OPENSBI_MCYCLE, mcycles);
+	if (category != SBI_PMU_FW_OPENSBI_MCYCLE)
+		sbi_pmu_ctr_add_opensbi_fw(category, mcycles);
+}
+
 /**
  * Handle trap/interrupt
  *
@@ -264,16 +276,38 @@ struct sbi_trap_regs *sbi_trap_handler(struct sbi_trap_regs *regs)
 {
 	int rc = SBI_ENOTSUPP;
 	const char *msg = "trap handler failed";
+	ulong mcycle_start = csr_read(CSR_MCYCLE);
 	ulong mcause = csr_read(CSR_MCAUSE);
 	ulong mtval = csr_read(CSR_MTVAL), mtval2 = 0, mtinst = 0;
+	enum sbi_pmu_fw_opensbi_event_id residency = SBI_PMU_FW_OPENSBI_MCYCLE;
+	/* Nested traps are accounted to the trap they happened in */
+	bool from_m = ((regs->mstatus & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT) ==
+		      PRV_M;
+#if __riscv_xlen == 32
+	bool prev_virt = (regs->mstatusH & MSTATUSH_MPV) ? TRUE : FALSE;
+#else
+	bool prev_virt = (regs->mstatus & MSTATUS_MPV) ? TRUE : FALSE;
+#endif
 	struct sbi_trap_info trap;
 
+	if (!from_m)
+		sbi_pmu_set_trap_virt(prev_virt);
+
 	if (misa_extension('H')) {
 		mtval2 = csr_read(CSR_MTVAL2);
 		mtinst = csr_read(CSR_MTINST);
 	}
 
 	if (mcause & (1UL << (__riscv_xlen - 1))) {
+		switch (mcause & ~(1UL << (__riscv_xlen - 1))) {
+		case IRQ_M_TIMER:
+			residency = SBI_PMU_FW_OPENSBI_MCYCLE_TIMER;
+			break;
+		case IRQ_M_SOFT:
+			residency = SBI_PMU_FW_OPENSBI_MCYCLE_IPI;
+			break;
+		}
+
 		if (sbi_hart_has_extension(sbi_scratch_thishart_ptr(),
 					   SBI_HART_EXT_SMAIA))
 			rc = sbi_trap_aia_irq(regs, mcause);
@@ -283,24 +317,44 @@ struct sbi_trap_regs *sbi_trap_handler(struct sbi_trap_regs *regs)
 			msg = "unhandled local interrupt";
 			goto trap_error;
 		}
-		return regs;
+		goto trap_done;
+	}
+
+	/*
+	 * Faulting M-mode accesses on behalf of lower privilege modes
+	 * resume at the fixup address registered in exception table.
+	 */
+	if (from_m) {
+		trap.epc = regs->mepc;
+		trap.cause = mcause;
+		trap.tval = mtval;
+		trap.tval2 = mtval2;
+		trap.tinst = mtinst;
+		trap.gva   = sbi_regs_gva(regs);
+
+		if (!sbi_extable_fixup(regs, &trap))
+			return regs;
 	}
 
 	switch (mcause) {
 	case CAUSE_ILLEGAL_INSTRUCTION:
+		residency = SBI_PMU_FW_OPENSBI_MCYCLE_ILLEGAL_INSN;
 		rc  = sbi_illegal_insn_handler(mtval, regs);
 		msg = "illegal instruction handler failed";
 		break;
 	case CAUSE_MISALIGNED_LOAD:
+		residency = SBI_PMU_FW_OPENSBI_MCYCLE_MISALIGNED;
 		rc = sbi_misaligned_load_handler(mtval, mtval2, mtinst, regs);
 		msg = "misaligned load handler failed";
 		break;
 	case CAUSE_MISALIGNED_STORE:
+		residency = SBI_PMU_FW_OPENSBI_MCYCLE_MISALIGNED;
 		rc  = sbi_misaligned_store_handler(mtval, mtval2, mtinst, regs);
 		msg = "misaligned store handler failed";
 		break;
 	case CAUSE_SUPERVISOR_ECALL:
 	case CAUSE_MACHINE_ECALL:
+		residency = SBI_PMU_FW_OPENSBI_MCYCLE_ECALL;
 		rc  = sbi_ecall_handler(regs);
 		msg = "ecall handler failed";
 		break;
@@ -325,6 +379,11 @@ struct sbi_trap_regs *sbi_trap_handler(struct sbi_trap_regs *regs)
 trap_error:
 	if (rc)
 		sbi_trap_error(msg, rc, mcause, mtval, mtval2, mtinst, regs);
+trap_done:
+	if (!from_m) {
+		sbi_trap_residency(mcycle_start, residency);
+		sbi_pmu_set_trap_virt(FALSE);
+	}
 	return regs;
 }
 
@@ -9,39 +9,34 @@
 
 #include <sbi/riscv_encoding.h>
 #include <sbi/sbi_bitops.h>
-#include <sbi/sbi_hart.h>
+#include <sbi/sbi_extable.h>
 #include <sbi/sbi_scratch.h>
+#include <sbi/sbi_string.h>
 #include <sbi/sbi_trap.h>
 #include <sbi/sbi_unpriv.h>
 
 /**
- * a3 must a pointer to the sbi_trap_info and a4 is used as a temporary
- * register in the trap handler. Make sure that compiler doesn't use a3 & a4.
+ * a3 must a pointer to the sbi_trap_info because a fault on the access
+ * is handled by sbi_trap_handler() through the exception table which
+ * saves trap details using a3 and resumes execution at the fixup label.
  */
 #define DEFINE_UNPRIVILEGED_LOAD_FUNCTION(type, insn)                         \
 	type sbi_load_##type(const type *addr,                                \
 			     struct sbi_trap_info *trap)                      \
 	{                                                                     \
-		register ulong tinfo asm("a3");                               \
+		register ulong tinfo asm("a3") = (ulong)trap;                 \
 		register ulong mstatus = 0;                                   \
-		register ulong mtvec = sbi_hart_expected_trap_addr();         \
 		type ret = 0;                                                 \
 		trap->cause = 0;                                              \
 		asm volatile(                                                 \
-			"add %[tinfo], %[taddr], zero\n"                      \
-			"csrrw %[mtvec], " STR(CSR_MTVEC) ", %[mtvec]\n"      \
 			"csrrs %[mstatus], " STR(CSR_MSTATUS) ", %[mprv]\n"   \
-			".option push\n"                                      \
-			".option norvc\n"                                     \
-			#insn " %[ret], %[addr]\n"                            \
-			".option pop\n"                                       \
-			"csrw " STR(CSR_MSTATUS) ", %[mstatus]\n"             \
-			"csrw " STR(CSR_MTVEC) ", %[mtvec]"                   \
-		    : [mstatus] "+&r"(mstatus), [mtvec] "+&r"(mtvec),         \
-		      [tinfo] "+&r"(tinfo), [ret] "=&r"(ret)                  \
+			"1: " #insn " %[ret], %[addr]\n"                      \
+			"2: csrw " STR(CSR_MSTATUS) ", %[mstatus]\n"          \
+			SBI_EXTABLE_ENTRY(1b, 2b)                             \
+		    : [mstatus] "+&r"(mstatus), [ret] "=&r"(ret)              \
 		    : [addr] "m"(*addr), [mprv] "r"(MSTATUS_MPRV),            \
-		      [taddr] "r"((ulong)trap)                                \
-		    : "a4", "memory");                                        \
+		      [tinfo] "r"(tinfo)                                      \
+		    : "memory");                                              \
 		return ret;                                                   \
 	}
 
@@ -51,23 +46,16 @@
 	{                                                                     \
 		register ulong tinfo asm("a3") = (ulong)trap;                 \
 		register ulong mstatus = 0;                                   \
-		register ulong mtvec = sbi_hart_expected_trap_addr();         \
 		trap->cause = 0;                                              \
 		asm volatile(                                                 \
-			"add %[tinfo], %[taddr], zero\n"                      \
-			"csrrw %[mtvec], " STR(CSR_MTVEC) ", %[mtvec]\n"      \
 			"csrrs %[mstatus], " STR(CSR_MSTATUS) ", %[mprv]\n"   \
-			".option push\n"                                      \
-			".option norvc\n"                                     \
-			#insn " %[val], %[addr]\n"                            \
-			".option pop\n"                                       \
-			"csrw " STR(CSR_MSTATUS) ", %[mstatus]\n"             \
-			"csrw " STR(CSR_MTVEC) ", %[mtvec]"                   \
-		    : [mstatus] "+&r"(mstatus), [mtvec] "+&r"(mtvec),         \
-		      [tinfo] "+&r"(tinfo)                                    \
+			"1: " #insn " %[val], %[addr]\n"                      \
+			"2: csrw " STR(CSR_MSTATUS) ", %[mstatus]\n"          \
+			SBI_EXTABLE_ENTRY(1b, 2b)                             \
+		    : [mstatus] "+&r"(mstatus)                                \
 		    : [addr] "m"(*addr), [mprv] "r"(MSTATUS_MPRV),            \
-		      [val] "r"(val), [taddr] "r"((ulong)trap)                \
-		    : "a4", "memory");                                        \
+		      [val] "r"(val), [tinfo] "r"(tinfo)                      \
+		    : "memory");                                              \
 	}
 
 DEFINE_UNPRIVILEGED_LOAD_FUNCTION(u8, lbu)
@@ -116,34 +104,238 @@ void sbi_store_u64(u64 *addr, u64 val,
 # error "Unexpected __riscv_xlen"
 #endif
 
+ulong sbi_load_guarded_ulong(const ulong *addr, struct sbi_trap_info *trap)
+{
+	register ulong tinfo asm("a3") = (ulong)trap;
+	ulong ret = 0;
+
+	trap->cause = 0;
+	asm volatile(
+		"1: " REG_L " %[ret], %[addr]\n"
+		"2:\n"
+		SBI_EXTABLE_ENTRY(1b, 2b)
+	    : [ret] "+&r"(ret)
+	    : [addr] "m"(*addr), [tinfo] "r"(tinfo)
+	    : "memory");
+
+	return ret;
+}
+
+/* Number of words moved for each MSTATUS.MPRV window of bulk copies */
+#define UNPRIV_COPY_CHUNK_WORDS		8
+#define UNPRIV_COPY_CHUNK_BYTES		(UNPRIV_COPY_CHUNK_WORDS * sizeof(ulong))
+
+/*
+ * M-mode memory (such as the destination of a copy or the stack) is not
+ * reachable while MSTATUS.MPRV is set, so bulk copies move data through
+ * registers in chunks of UNPRIV_COPY_CHUNK_WORDS aligned words, toggling
+ * MSTATUS.MPRV once per chunk. Aligned words never cross a page so a
+ * fault is reported for the exact page being accessed.
+ */
+static void unpriv_load_chunk(ulong *buf, const ulong *addr,
+			      struct sbi_trap_info *trap)
+{
+	register ulong tinfo asm("a3") = (ulong)trap;
+	register ulong mstatus = 0;
+	ulong v0, v1, v2, v3, v4, v5, v6, v7;
+
+	trap->cause = 0;
+	asm volatile(
+		"csrrs %[mstatus], " STR(CSR_MSTATUS) ", %[mprv]\n"
+		"1: " REG_L " %[v0], (0 * " RISCV_SZPTR ")(%[addr])\n"
+		"2: " REG_L " %[v1], (1 * " RISCV_SZPTR ")(%[addr])\n"
+		"3: " REG_L " %[v2], (2 * " RISCV_SZPTR ")(%[addr])\n"
+		"4: " REG_L " %[v3], (3 * " RISCV_SZPTR ")(%[addr])\n"
+		"5: " REG_L " %[v4], (4 * " RISCV_SZPTR ")(%[addr])\n"
+		"6: " REG_L " %[v5], (5 * " RISCV_SZPTR ")(%[addr])\n"
+		"7: " REG_L " %[v6], (6 * " RISCV_SZPTR ")(%[addr])\n"
+		"8: " REG_L " %[v7], (7 * " RISCV_SZPTR ")(%[addr])\n"
+		"9: csrw " STR(CSR_MSTATUS) ", %[mstatus]\n"
+		SBI_EXTABLE_ENTRY(1b, 9b)
+		SBI_EXTABLE_ENTRY(2b, 9b)
+		SBI_EXTABLE_ENTRY(3b, 9b)
+		SBI_EXTABLE_ENTRY(4b, 9b)
+		SBI_EXTABLE_ENTRY(5b, 9b)
+		SBI_EXTABLE_ENTRY(6b, 9b)
+		SBI_EXTABLE_ENTRY(7b, 9b)
+		SBI_EXTABLE_ENTRY(8b, 9b)
+	    : [mstatus] "+&r"(mstatus),
+	      [v0] "=&r"(v0), [v1] "=&r"(v1), [v2] "=&r"(v2), [v3] "=&r"(v3),
+	      [v4] "=&r"(v4), [v5] "=&r"(v5), [v6] "=&r"(v6), [v7] "=&r"(v7)
+	    : [addr] "r"(addr), [mprv] "r"(MSTATUS_MPRV), [tinfo] "r"(tinfo)
+	    : "memory");
+
+	buf[0] = v0;
+	buf[1] = v1;
+	buf[2] = v2;
+	buf[3] = v3;
+	buf[4] = v4;
+	buf[5] = v5;
+	buf[6] = v6;
+	buf[7] = v7;
+}
+
+static void unpriv_store_chunk(ulong *addr, const ulong *buf,
+			       struct sbi_trap_info *trap)
+{
+	register ulong tinfo asm("a3") = (ulong)trap;
+	register ulong mstatus = 0;
+
+	trap->cause = 0;
+	asm volatile(
+		"csrrs %[mstatus], " STR(CSR_MSTATUS) ", %[mprv]\n"
+		"1: " REG_S " %[v0], (0 * " RISCV_SZPTR ")(%[addr])\n"
+		"2: " REG_S " %[v1], (1 * " RISCV_SZPTR ")(%[addr])\n"
+		"3: " REG_S " %[v2], (2 * " RISCV_SZPTR ")(%[addr])\n"
+		"4: " REG_S " %[v3], (3 * " RISCV_SZPTR ")(%[addr])\n"
+		"5: " REG_S " %[v4], (4 * " RISCV_SZPTR ")(%[addr])\n"
+		"6: " REG_S " %[v5], (5 * " RISCV_SZPTR ")(%[addr])\n"
+		"7: " REG_S " %[v6], (6 * " RISCV_SZPTR ")(%[addr])\n"
+		"8: " REG_S " %[v7], (7 * " RISCV_SZPTR ")(%[addr])\n"
+		"9: csrw " STR(CSR_MSTATUS) ", %[mstatus]\n"
+		SBI_EXTABLE_ENTRY(1b, 9b)
+		SBI_EXTABLE_ENTRY(2b, 9b)
+		SBI_EXTABLE_ENTRY(3b, 9b)
+		SBI_EXTABLE_ENTRY(4b, 9b)
+		SBI_EXTABLE_ENTRY(5b, 9b)
+		SBI_EXTABLE_ENTRY(6b, 9b)
+		SBI_EXTABLE_ENTRY(7b, 9b)
+		SBI_EXTABLE_ENTRY(8b, 9b)
+	    : [mstatus] "+&r"(mstatus)
+	    : [addr] "r"(addr), [mprv] "r"(MSTATUS_MPRV), [tinfo] "r"(tinfo),
+	      [v0] "r"(buf[0]), [v1] "r"(buf[1]), [v2] "r"(buf[2]),
+	      [v3] "r"(buf[3]), [v4] "r"(buf[4]), [v5] "r"(buf[5]),
+	      [v6] "r"(buf[6]), [v7] "r"(buf[7])
+	    : "memory");
+}
+
+void sbi_unpriv_copy_from(void *dst, const void *src, ulong len,
+			  struct sbi_trap_info *trap)
+{
+	ulong buf[UNPRIV_COPY_CHUNK_WORDS];
+	ulong addr = (ulong)src;
+	u8 *out = dst;
+
+	trap->cause = 0;
+
+	/* Leading bytes until the source is word aligned */
+	while (len && (addr & (sizeof(ulong) - 1))) {
+		*out = sbi_load_u8((const u8 *)addr, trap);
+		if (trap->cause)
+			return;
+		out++;
+		addr++;
+		len--;
+	}
+
+	while (len >= UNPRIV_COPY_CHUNK_BYTES) {
+		unpriv_load_chunk(buf, (const ulong *)addr, trap);
+		if (trap->cause)
+			return;
+		sbi_memcpy(out, buf, UNPRIV_COPY_CHUNK_BYTES);
+		out += UNPRIV_COPY_CHUNK_BYTES;
+		addr += UNPRIV_COPY_CHUNK_BYTES;
+		len -= UNPRIV_COPY_CHUNK_BYTES;
+	}
+
+	while (len >= sizeof(ulong)) {
+		buf[0] = sbi_load_ulong((const ulong *)addr, trap);
+		if (trap->cause)
+			return;
+		sbi_memcpy(out, buf, sizeof(ulong));
+		out += sizeof(ulong);
+		addr += sizeof(ulong);
+		len -= sizeof(ulong);
+	}
+
+	while (len) {
+		*out = sbi_load_u8((const u8 *)addr, trap);
+		if (trap->cause)
+			return;
+		out++;
+		addr++;
+		len--;
+	}
+}
+
+void sbi_unpriv_copy_to(void *dst, const void *src, ulong len,
+			struct sbi_trap_info *trap)
+{
+	ulong buf[UNPRIV_COPY_CHUNK_WORDS];
+	ulong addr = (ulong)dst;
+	const u8 *in = src;
+
+	trap->cause = 0;
+
+	/* Leading bytes until the destination is word aligned */
+	while (len && (addr & (sizeof(ulong) - 1))) {
+		sbi_store_u8((u8 *)addr, *in, trap);
+		if (trap->cause)
+			return;
+		in++;
+		addr++;
+		len--;
+	}
+
+	while (len >= UNPRIV_COPY_CHUNK_BYTES) {
+		sbi_memcpy(buf, in, UNPRIV_COPY_CHUNK_BYTES);
+		unpriv_store_chunk((ulong *)addr, buf, trap);
+		if (trap->cause)
+			return;
+		in += UNPRIV_COPY_CHUNK_BYTES;
+		addr += UNPRIV_COPY_CHUNK_BYTES;
+		len -= UNPRIV_COPY_CHUNK_BYTES;
+	}
+
+	while (len >= sizeof(ulong)) {
+		sbi_memcpy(buf, in, sizeof(ulong));
+#if __riscv_xlen == 64
+		sbi_store_u64((u64 *)addr, buf[0], trap);
+#else
+		sbi_store_u32((u32 *)addr, buf[0], trap);
+#endif
+		if (trap->cause)
+			return;
+		in += sizeof(ulong);
+		addr += sizeof(ulong);
+		len -= sizeof(ulong);
+	}
+
+	while (len) {
+		sbi_store_u8((u8 *)addr, *in, trap);
+		if (trap->cause)
+			return;
+		in++;
+		addr++;
+		len--;
+	}
+}
+
 ulong sbi_get_insn(ulong mepc, struct sbi_trap_info *trap)
 {
-	register ulong tinfo asm("a3");
-	register ulong ttmp asm("a4");
+	register ulong tinfo asm("a3") = (ulong)trap;
+	register ulong ttmp;
 	register ulong mstatus = 0;
-	register ulong mtvec = sbi_hart_expected_trap_addr();
 	ulong insn = 0;
 
 	trap->cause = 0;
 
 	asm volatile(
-	    "add %[tinfo], %[taddr], zero\n"
-	    "csrrw %[mtvec], " STR(CSR_MTVEC) ", %[mtvec]\n"
 	    "csrrs %[mstatus], " STR(CSR_MSTATUS) ", %[mprv]\n"
-	    "lhu %[insn], (%[addr])\n"
+	    "1: lhu %[insn], (%[addr])\n"
 	    "andi %[ttmp], %[insn], 3\n"
 	    "addi %[ttmp], %[ttmp], -3\n"
 	    "bne %[ttmp], zero, 2f\n"
-	    "lhu %[ttmp], 2(%[addr])\n"
+	    "3: lhu %[ttmp], 2(%[addr])\n"
 	    "sll %[ttmp], %[ttmp], 16\n"
 	    "add %[insn], %[insn], %[ttmp]\n"
 	    "2: csrw " STR(CSR_MSTATUS) ", %[mstatus]\n"
-	    "csrw " STR(CSR_MTVEC) ", %[mtvec]"
-	    : [mstatus] "+&r"(mstatus), [mtvec] "+&r"(mtvec),
-	      [tinfo] "+&r"(tinfo), [ttmp] "+&r"(ttmp),
-	      [insn] "=&r"(insn)
+	    SBI_EXTABLE_ENTRY(1b, 2b)
+	    SBI_EXTABLE_ENTRY(3b, 2b)
+	    : [mstatus] "+&r"(mstatus), [ttmp] "=&r"(ttmp),
+	      [insn] "+&r"(insn)
 	    : [mprv] "r"(MSTATUS_MPRV | MSTATUS_MXR),
-	      [taddr] "r"((ulong)trap), [addr] "r"(mepc)
+	      [tinfo] "r"(tinfo), [addr] "r"(mepc)
 	    : "memory");
 
 	switch (trap->cause) {
@@ -0,0 +1,5 @@
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+libsbiutils-objs-$(CONFIG_CACHE_THEAD_C9XX) += cache/thead_c9xx_cache.o
@@ -0,0 +1,99 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Cache maintenance helpers shared by the T-HEAD C9xx based platforms.
+ */
+
+#include <sbi/riscv_asm.h>
+#include <sbi/sbi_domain.h>
+#include <sbi/sbi_error.h>
+#include <sbi/sbi_platform.h>
+#include <sbi_utils/cache/thead_c9xx_cache.h>
+
+static void thead_c9xx_dcache_line(int op, unsigned long paddr)
+{
+	register unsigned long a0 asm("a0") = paddr;
+
+	switch (op) {
+	case SBI_CBO_INVAL:
+		asm volatile(THEAD_C9XX_DCACHE_IPA_A0 : : "r"(a0) : "memory");
+		break;
+	case SBI_CBO_CLEAN:
+		asm volatile(THEAD_C9XX_DCACHE_CPA_A0 : : "r"(a0) : "memory");
+		break;
+	case SBI_CBO_FLUSH:
+		asm volatile(THEAD_C9XX_DCACHE_CIPA_A0 : : "r"(a0) : "memory");
+		break;
+	}
+}
+
+int thead_c9xx_cbo_op(int op, unsigned long paddr, unsigned long size)
+{
+	unsigned long addr, end = paddr + size;
+
+	if (op != SBI_CBO_INVAL && op != SBI_CBO_CLEAN && op != SBI_CBO_FLUSH)
+		return SBI_EINVAL;
+
+	for (addr = paddr & ~(THEAD_C9XX_CACHE_LINE_SIZE - 1); addr < end;
+	     addr += THEAD_C9XX_CACHE_LINE_SIZE)
+		thead_c9xx_dcache_line(op, addr);
+
+	/* Wait for the operations to complete on all harts */
+	asm volatile(THEAD_C9XX_SYNC_S : : : "memory");
+
+	return 0;
+}
+
+int thead_c9xx_cache_range(unsigned long paddr, unsigned long size,
+			   unsigned long op, unsigned long whole)
+{
+	const struct sbi_platform *plat = sbi_platform_thishart_ptr();
+	unsigned long start, end = paddr + size;
+	unsigned long line = THEAD_C9XX_CACHE_LINE_SIZE;
+	unsigned long flags = SBI_DOMAIN_READ;
+
+	if (op != SBI_CBO_INVAL && op != SBI_CBO_CLEAN && op != SBI_CBO_FLUSH)
+		return SBI_EINVAL;
+	if (!size)
+		return 0;
+	if (end < paddr)
+		return SBI_EINVALID_ADDR;
+
+	/* Invalidation can discard data so it needs write permission */
+	if (op != SBI_CBO_CLEAN)
+		flags |= SBI_DOMAIN_WRITE;
+	if (!sbi_domain_check_addr_range(sbi_domain_thishart_ptr(),
+					 paddr, size, PRV_S, flags))
+		return SBI_EINVALID_ADDR;
+
+	/*
+	 * Cleaning lines outside the range is harmless, but invalidating
+	 * the whole cache would drop unrelated dirty data so invalidation
+	 * always walks the range. MCOR only acts on the L1 of the calling
+	 * hart whereas the line operations are broadcast, so the whole
+	 * cache shortcut is limited to single hart systems.
+	 */
+	if (op != SBI_CBO_INVAL && whole && size >= whole &&
+	    plat->hart_count == 1) {
+		csr_write(THEAD_C9XX_CSR_MCOR, THEAD_C9XX_MCOR_DCACHE |
+			  THEAD_C9XX_MCOR_CLR |
+			  ((op == SBI_CBO_FLUSH) ? THEAD_C9XX_MCOR_INV : 0));
+		asm volatile(THEAD_C9XX_SYNC_S : : : "memory");
+		return 0;
+	}
+
+	if (op != SBI_CBO_INVAL)
+		return thead_c9xx_cbo_op(op, paddr, size);
+
+	/* Partial lines at the edges also hold data outside the range */
+	start = (paddr + line - 1) & ~(line - 1);
+	if (paddr & (line - 1))
+		thead_c9xx_cbo_op(SBI_CBO_FLUSH, paddr, 1);
+	if ((end & (line - 1)) && (end & ~(line - 1)) >= start)
+		thead_c9xx_cbo_op(SBI_CBO_FLUSH, end - 1, 1);
+	end &= ~(line - 1);
+	if (start < end)
+		thead_c9xx_cbo_op(SBI_CBO_INVAL, start, end - start);
+
+	return 0;
+}
@@ -9,6 +9,7 @@
  */
 
 #include <libfdt.h>
+#include <sbi/sbi_console.h>
 #include <sbi/sbi_hart.h>
 #include <sbi/sbi_error.h>
 #include <sbi/sbi_pmu.h>
@@ -21,20 +22,52 @@ struct fdt_pmu_hw_event_select {
 	uint64_t select;
 };
 
+/* Event selectors of riscv,event-to-mhpmevent sorted by event idx */
 static struct fdt_pmu_hw_event_select fdt_pmu_evt_select[FDT_PMU_HW_EVENT_MAX] = {0};
 static uint32_t hw_event_count;
 
+/* Position of the first selector with an event idx not below event_idx */
+static uint32_t fdt_pmu_select_lower(uint32_t event_idx)
+{
+	uint32_t lo = 0, hi = hw_event_count, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (fdt_pmu_evt_select[mid].eidx < event_idx)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
 uint64_t fdt_pmu_get_select_value(uint32_t event_idx)
 {
-	int i;
-	struct fdt_pmu_hw_event_select *event;
+	uint32_t pos = fdt_pmu_select_lower(event_idx);
+
+	if (pos < hw_event_count && fdt_pmu_evt_select[pos].eidx == event_idx)
+		return fdt_pmu_evt_select[pos].select;
+
+	return 0;
+}
+
+static int fdt_pmu_add_select(uint32_t eidx, uint64_t select)
+{
+	uint32_t i, pos = fdt_pmu_select_lower(eidx);
 
-	for (i = 0; i < SBI_PMU_HW_EVENT_MAX; i++) {
-		event = &fdt_pmu_evt_select[i];
-		if (event->eidx == event_idx)
-			return event->select;
+	if (pos < hw_event_count && fdt_pmu_evt_select[pos].eidx == eidx) {
+		sbi_printf("%s: duplicate selector for event 0x%x\n",
+			   __func__, eidx);
+		return SBI_EINVAL;
 	}
 
+	for (i = hw_event_count; i > pos; i--)
+		fdt_pmu_evt_select[i] = fdt_pmu_evt_select[i - 1];
+	fdt_pmu_evt_select[pos].eidx = eidx;
+	fdt_pmu_evt_select[pos].select = select;
+	hw_event_count++;
+
 	return 0;
 }
 
@@ -64,8 +97,7 @@ int fdt_pmu_setup(void *fdt)
 	int i, pmu_offset, len, result;
 	const u32 *event_val;
 	const u32 *event_ctr_map;
-	struct fdt_pmu_hw_event_select *event;
-	uint64_t raw_selector, select_mask;
+	uint64_t raw_selector, select_mask, select;
 	u32 event_idx_start, event_idx_end, ctr_map;
 
 	if (!fdt)
@@ -77,7 +109,12 @@ int fdt_pmu_setup(void *fdt)
 
 	event_ctr_map = fdt_getprop(fdt, pmu_offset,
 				    "riscv,event-to-mhpmcounters", &len);
-	if (event_ctr_map && len >= 8) {
+	if (event_ctr_map) {
+		if (len % (sizeof(u32) * 3)) {
+			sbi_printf("%s: invalid riscv,event-to-mhpmcounters\n",
+				   __func__);
+			return SBI_EINVAL;
+		}
 		len = len / (sizeof(u32) * 3);
 		for (i = 0; i < len; i++) {
 			event_idx_start = fdt32_to_cpu(event_ctr_map[3 * i]);
@@ -85,28 +122,52 @@ int fdt_pmu_setup(void *fdt)
 			ctr_map = fdt32_to_cpu(event_ctr_map[3 * i + 2]);
 			result = sbi_pmu_add_hw_event_counter_map(
 				event_idx_start, event_idx_end, ctr_map);
-			if (result)
+			if (result) {
+				sbi_printf("%s: event range 0x%x-0x%x rejected "
+					   "(error %d)\n", __func__,
+					   event_idx_start, event_idx_end,
+					   result);
 				return result;
+			}
 		}
 	}
 
+	/* Kept sorted so that counter configuration can binary search it */
+	hw_event_count = 0;
 	event_val = fdt_getprop(fdt, pmu_offset,
 				"riscv,event-to-mhpmevent", &len);
-	if (event_val && len >= 8) {
+	if (event_val) {
+		if (len % (sizeof(u32) * 3)) {
+			sbi_printf("%s: invalid riscv,event-to-mhpmevent\n",
+				   __func__);
+			return SBI_EINVAL;
+		}
 		len = len / (sizeof(u32) * 3);
+		if (len > FDT_PMU_HW_EVENT_MAX) {
+			sbi_printf("%s: can not handle more than %d event "
+				   "selectors\n", __func__,
+				   FDT_PMU_HW_EVENT_MAX);
+			return SBI_ENOSPC;
+		}
 		for (i = 0; i < len; i++) {
-			event = &fdt_pmu_evt_select[hw_event_count];
-			event->eidx = fdt32_to_cpu(event_val[3 * i]);
-			event->select = fdt32_to_cpu(event_val[3 * i + 1]);
-			event->select = (event->select << 32) |
-					fdt32_to_cpu(event_val[3 * i + 2]);
-			hw_event_count++;
+			select = fdt32_to_cpu(event_val[3 * i + 1]);
+			select = (select << 32) |
+				 fdt32_to_cpu(event_val[3 * i + 2]);
+			result = fdt_pmu_add_select(
+					fdt32_to_cpu(event_val[3 * i]), select);
+			if (result)
+				return result;
 		}
 	}
 
 	event_val = fdt_getprop(fdt, pmu_offset,
 				"riscv,raw-event-to-mhpmcounters", &len);
-	if (event_val && len >= 20) {
+	if (event_val) {
+		if (len % (sizeof(u32) * 5)) {
+			sbi_printf("%s: invalid riscv,raw-event-to-mhpmcounters\n",
+				   __func__);
+			return SBI_EINVAL;
+		}
 		len = len / (sizeof(u32) * 5);
 		for (i = 0; i < len; i++) {
 			raw_selector = fdt32_to_cpu(event_val[5 * i]);
@@ -118,10 +179,23 @@ int fdt_pmu_setup(void *fdt)
 			ctr_map = fdt32_to_cpu(event_val[5 * i + 4]);
 			result = sbi_pmu_add_raw_event_counter_map(
 					raw_selector, select_mask, ctr_map);
-			if (result)
+			if (result) {
+				sbi_printf("%s: raw event 0x%llx/0x%llx rejected "
+					   "(error %d)\n", __func__,
+					   (unsigned long long)raw_selector,
+					   (unsigned long long)select_mask,
+					   result);
 				return result;
+			}
 		}
 	}
 
+	event_val = fdt_getprop(fdt, pmu_offset, "opensbi,mux-period-us", &len);
+	if (event_val && len >= sizeof(u32)) {
+		result = sbi_pmu_set_mux_period(fdt32_to_cpu(*event_val));
+		if (result)
+			return result;
+	}
+
 	return 0;
 }
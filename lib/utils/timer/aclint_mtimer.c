@@ -11,6 +11,7 @@
 #include <sbi/riscv_atomic.h>
 #include <sbi/riscv_io.h>
 #include <sbi/sbi_bitops.h>
+#include <sbi/sbi_console.h>
 #include <sbi/sbi_domain.h>
 #include <sbi/sbi_error.h>
 #include <sbi/sbi_hartmask.h>
@@ -88,28 +89,124 @@ static struct sbi_timer_device mtimer = {
 	.timer_event_stop = mtimer_event_stop
 };
 
-void aclint_mtimer_sync(struct aclint_mtimer_data *mt)
+/* Number of samples taken for one MTIME offset estimate */
+#define MTIMER_SYNC_ROUNDS		8
+
+/* Maximum number of corrections applied by one sync-up */
+#define MTIMER_SYNC_PASSES		3
+
+/*
+ * Estimate the offset of MTIME against the reference MTIME. Every round
+ * samples the reference between two local reads, and the round with the
+ * smallest round trip time bounds the local time of the reference sample
+ * most tightly.
+ */
+static s64 mtimer_sync_offset(struct aclint_mtimer_data *mt, u64 *rtt)
+{
+	u32 i;
+	s64 offset = 0;
+	u64 v1, v2, mv, best_rtt = -1ULL;
+	struct aclint_mtimer_data *reference = mt->time_delta_reference;
+	u64 *mt_time_val = (void *)mt->mtime_addr;
+	u64 *ref_time_val = (void *)reference->mtime_addr;
+
+	for (i = 0; i < MTIMER_SYNC_ROUNDS; i++) {
+		v1 = mt->time_rd(mt_time_val);
+		mv = reference->time_rd(ref_time_val);
+		v2 = mt->time_rd(mt_time_val);
+		if (v2 - v1 < best_rtt) {
+			best_rtt = v2 - v1;
+			offset = (s64)(mv - (v1 + best_rtt / 2));
+		}
+	}
+
+	*rtt = best_rtt;
+	return offset;
+}
+
+/*
+ * Step MTIME towards the reference. Writing MTIME takes time which the
+ * estimate does not cover, so measure again after every step until the
+ * offset is within the measurement uncertainty.
+ */
+static void mtimer_sync_step(struct aclint_mtimer_data *mt, bool forward_only)
 {
-	u64 v1, v2, mv, delta;
-	u64 *mt_time_val, *ref_time_val;
-	struct aclint_mtimer_data *reference;
+	u32 pass;
+	s64 offset;
+	u64 rtt, *mt_time_val = (void *)mt->mtime_addr;
+
+	for (pass = 0; ; pass++) {
+		offset = mtimer_sync_offset(mt, &rtt);
+		if ((offset < 0 ? -offset : offset) <= rtt / 2 ||
+		    (offset < 0 && forward_only) ||
+		    pass == MTIMER_SYNC_PASSES)
+			break;
+		mt->time_wr(false, mt->time_rd(mt_time_val) + offset,
+			    mt_time_val);
+	}
 
+	mt->time_delta_skew = offset;
+	mt->time_delta_rtt = rtt;
+}
+
+void aclint_mtimer_sync(struct aclint_mtimer_data *mt)
+{
 	/* Sync-up non-shared MTIME if reference is available */
 	if (mt->has_shared_mtime || !mt->time_delta_reference)
 		return;
 
-	reference = mt->time_delta_reference;
-	mt_time_val = (void *)mt->mtime_addr;
-	ref_time_val = (void *)reference->mtime_addr;
 	if (!atomic_raw_xchg_ulong(&mt->time_delta_computed, 1)) {
-		v1 = mt->time_rd(mt_time_val);
-		mv = reference->time_rd(ref_time_val);
-		v2 = mt->time_rd(mt_time_val);
-		delta = mv - ((v1 / 2) + (v2 / 2));
-		mt->time_wr(false, mt->time_rd(mt_time_val) + delta,
-			    mt_time_val);
+		mtimer_sync_step(mt, false);
+		sbi_printf("%s: MTIMER@0x%lx residual skew %ld ticks "
+			   "(rtt %lu ticks)\n", __func__, mt->mtime_addr,
+			   (long)mt->time_delta_skew,
+			   (unsigned long)mt->time_delta_rtt);
 	}
+}
 
+static u64 mtimer_resync_period(struct aclint_mtimer_data *mt)
+{
+	return ((u64)mt->mtime_freq * mt->resync_period_ms) / 1000;
+}
+
+static void mtimer_resync_handler(struct sbi_timer_event *ev)
+{
+	struct aclint_mtimer_data *mt = ev->priv;
+
+	/*
+	 * S-mode is running by now so MTIME must never go backwards. A
+	 * MTIME running ahead of the reference is only reported.
+	 */
+	mtimer_sync_step(mt, true);
+	if (mt->time_delta_skew < -(s64)mt->time_delta_rtt)
+		sbi_dprintf("%s: MTIMER@0x%lx ahead by %ld ticks\n",
+			    __func__, mt->mtime_addr,
+			    -(long)mt->time_delta_skew);
+
+	sbi_timer_event_add(ev, ev->time + mtimer_resync_period(mt));
+}
+
+static void mtimer_resync_start(struct aclint_mtimer_data *mt)
+{
+	long owner = current_hartid() + 1;
+
+	/*
+	 * Only 64-bit MTIME writes are atomic enough to be done while
+	 * S-mode reads the time. The first HART of the cluster to boot
+	 * keeps re-syncing it from then on.
+	 */
+	if (!mt->resync_period_ms || !mt->has_64bit_mmio ||
+	    mt->has_shared_mtime || !mt->time_delta_reference)
+		return;
+	if (atomic_cmpxchg(&mt->resync_owner, 0, owner) &&
+	    atomic_read(&mt->resync_owner) != owner)
+		return;
+
+	mt->resync_event.handler = mtimer_resync_handler;
+	mt->resync_event.priv = mt;
+	sbi_timer_event_add(&mt->resync_event,
+			    mt->time_rd((void *)mt->mtime_addr) +
+			    mtimer_resync_period(mt));
 }
 
 void aclint_mtimer_set_reference(struct aclint_mtimer_data *mt,
@@ -139,6 +236,9 @@ int aclint_mtimer_warm_init(void)
 	mt->time_wr(true, -1ULL,
 		    &mt_time_cmp[target_hart - mt->first_hartid]);
 
+	/* Keep correcting the drift of non-shared MTIME if requested */
+	mtimer_resync_start(mt);
+
 	return 0;
 }
 
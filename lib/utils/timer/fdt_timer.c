@@ -7,8 +7,10 @@
  *   Anup Patel <anup.patel@wdc.com>
  */
 
+#include <libfdt.h>
 #include <sbi/sbi_error.h>
 #include <sbi/sbi_scratch.h>
+#include <sbi/sbi_timer.h>
 #include <sbi_utils/fdt/fdt_helper.h>
 #include <sbi_utils/timer/fdt_timer.h>
 
@@ -38,6 +40,20 @@ static int fdt_timer_warm_init(void)
 	return 0;
 }
 
+static void fdt_timer_slack_init(void *fdt)
+{
+	const fdt32_t *val;
+	int coff, len;
+
+	coff = fdt_path_offset(fdt, "/chosen");
+	if (coff < 0)
+		return;
+
+	val = fdt_getprop(fdt, coff, "opensbi,timer-slack-us", &len);
+	if (val && len >= sizeof(fdt32_t))
+		sbi_timer_set_slack(fdt32_to_cpu(*val));
+}
+
 static int fdt_timer_cold_init(void)
 {
 	int pos, noff, rc;
@@ -65,6 +81,8 @@ static int fdt_timer_cold_init(void)
 			break;
 	}
 
+	fdt_timer_slack_init(fdt);
+
 	return 0;
 }
 
@@ -28,7 +28,8 @@ static struct aclint_mtimer_data *mt_reference = NULL;
 static int timer_mtimer_cold_init(void *fdt, int nodeoff,
 				  const struct fdt_match *match)
 {
-	int i, rc;
+	int i, rc, len;
+	const fdt32_t *val;
 	unsigned long addr[2], size[2];
 	struct aclint_mtimer_data *mt;
 
@@ -44,6 +45,10 @@ static int timer_mtimer_cold_init(void *fdt, int nodeoff,
 	mt->has_64bit_mmio = true;
 	mt->has_shared_mtime = false;
 
+	val = fdt_getprop(fdt, nodeoff, "opensbi,resync-period-ms", &len);
+	if (val && len >= sizeof(fdt32_t))
+		mt->resync_period_ms = fdt32_to_cpu(*val);
+
 	rc = fdt_parse_timebase_frequency(fdt, &mt->mtime_freq);
 	if (rc)
 		return rc;
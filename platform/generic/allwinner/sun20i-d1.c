@@ -8,10 +8,14 @@
 #include <thead_c9xx.h>
 #include <sbi/riscv_io.h>
 #include <sbi/sbi_bitops.h>
+#include <sbi/sbi_domain.h>
 #include <sbi/sbi_ecall_interface.h>
 #include <sbi/sbi_error.h>
 #include <sbi/sbi_hsm.h>
+#include <sbi/sbi_ipi.h>
+#include <sbi/sbi_platform.h>
 #include <sbi/sbi_pmu.h>
+#include <sbi_utils/cache/thead_c9xx_cache.h>
 #include <sbi_utils/fdt/fdt_helper.h>
 #include <sbi_utils/irqchip/fdt_irqchip_plic.h>
 
@@ -65,6 +69,79 @@ static void sun20i_d1_csr_restore(void)
 	csr_write(CSR_MHINT,	csr_mhint);
 }
 
+/*
+ * Misaligned access
+ */
+
+#define SUN20I_D1_SBI_EXT_HW_MISALIGNED	(SBI_EXT_VENDOR_START + 0x9)
+
+static bool sun20i_d1_hw_misaligned = true;
+
+static void sun20i_d1_misaligned_init(void)
+{
+	/* MXSTATUS is saved and restored across non-retentive suspend. */
+	if (sun20i_d1_hw_misaligned)
+		csr_set(CSR_MXSTATUS, THEAD_C9XX_MXSTATUS_MM);
+	else
+		csr_clear(CSR_MXSTATUS, THEAD_C9XX_MXSTATUS_MM);
+}
+
+static u32 sun20i_d1_misaligned_event = SBI_IPI_EVENT_MAX;
+
+static void sun20i_d1_misaligned_process(struct sbi_scratch *scratch)
+{
+	sun20i_d1_misaligned_init();
+}
+
+static struct sbi_ipi_event_ops sun20i_d1_misaligned_ipi_ops = {
+	.name = "IPI_SUN20I_D1_MISALIGNED",
+	.process = sun20i_d1_misaligned_process,
+};
+
+/*
+ * Switch hardware misaligned access on all harts, including harts
+ * started afterwards. With it off misaligned accesses trap and are
+ * emulated by OpenSBI, which is useful for debugging. As it affects
+ * every hart, only the root domain may change it.
+ */
+static int sun20i_d1_set_hw_misaligned(unsigned long enable,
+				       unsigned long *old)
+{
+	if (sun20i_d1_misaligned_event >= SBI_IPI_EVENT_MAX)
+		return SBI_ENOTSUPP;
+	if (sbi_domain_thishart_ptr() != &root)
+		return SBI_EDENIED;
+
+	*old = sun20i_d1_hw_misaligned ? 1 : 0;
+	sun20i_d1_hw_misaligned = enable ? true : false;
+	sun20i_d1_misaligned_init();
+
+	return sbi_ipi_send_many(0, -1UL, sun20i_d1_misaligned_event, NULL);
+}
+
+/*
+ * Cache maintenance
+ */
+
+#define SUN20I_D1_SBI_EXT_CACHE_RANGE	(SBI_EXT_VENDOR_START + 0xa)
+
+static unsigned long sun20i_d1_cbo_block_size(const struct fdt_match *match)
+{
+	return THEAD_C9XX_CACHE_LINE_SIZE;
+}
+
+static int sun20i_d1_cbo_op(int op, unsigned long paddr, unsigned long size,
+			    const struct fdt_match *match)
+{
+	return thead_c9xx_cbo_op(op, paddr, size);
+}
+
+/*
+ * Ranges at least this large are cleaned with a single whole cache
+ * operation on single hart systems instead of walking them line by line.
+ */
+#define SUN20I_D1_CACHE_RANGE_WHOLE	(32 * 1024)
+
 /*
  * PLIC
  */
@@ -192,11 +269,25 @@ static const struct sbi_hsm_device sun20i_d1_ppu = {
 	.hart_resume	= sun20i_d1_hart_resume,
 };
 
+static int sun20i_d1_early_init(bool cold_boot, const struct fdt_match *match)
+{
+	sun20i_d1_misaligned_init();
+
+	return 0;
+}
+
 static int sun20i_d1_final_init(bool cold_boot, const struct fdt_match *match)
 {
+	int ret;
+
 	if (cold_boot) {
 		sun20i_d1_riscv_cfg_init();
 		sbi_hsm_set_device(&sun20i_d1_ppu);
+
+		ret = sbi_ipi_event_create(&sun20i_d1_misaligned_ipi_ops);
+		if (ret < 0)
+			return ret;
+		sun20i_d1_misaligned_event = ret;
 	}
 
 	return 0;
@@ -257,6 +348,30 @@ static int sun20i_d1_extensions_init(const struct fdt_match *match,
 	return 0;
 }
 
+static int sun20i_d1_vendor_ext_check(long extid,
+				      const struct fdt_match *match)
+{
+	return extid == SUN20I_D1_SBI_EXT_HW_MISALIGNED ||
+	       extid == SUN20I_D1_SBI_EXT_CACHE_RANGE;
+}
+
+static int sun20i_d1_vendor_ext_provider(long extid, long funcid,
+					 const struct sbi_trap_regs *regs,
+					 unsigned long *out_value,
+					 struct sbi_trap_info *out_trap,
+					 const struct fdt_match *match)
+{
+	switch (extid) {
+	case SUN20I_D1_SBI_EXT_HW_MISALIGNED:
+		return sun20i_d1_set_hw_misaligned(regs->a0, out_value);
+	case SUN20I_D1_SBI_EXT_CACHE_RANGE:
+		return thead_c9xx_cache_range(regs->a0, regs->a1, regs->a2,
+					      SUN20I_D1_CACHE_RANGE_WHOLE);
+	default:
+		return SBI_ENOTSUPP;
+	}
+}
+
 static const struct fdt_match sun20i_d1_match[] = {
 	{ .compatible = "allwinner,sun20i-d1" },
 	{ },
@@ -264,6 +379,11 @@ static const struct fdt_match sun20i_d1_match[] = {
 
 const struct platform_override sun20i_d1 = {
 	.match_table	= sun20i_d1_match,
+	.early_init	= sun20i_d1_early_init,
 	.final_init	= sun20i_d1_final_init,
 	.extensions_init = sun20i_d1_extensions_init,
+	.cbo_block_size	= sun20i_d1_cbo_block_size,
+	.cbo_op		= sun20i_d1_cbo_op,
+	.vendor_ext_check = sun20i_d1_vendor_ext_check,
+	.vendor_ext_provider = sun20i_d1_vendor_ext_provider,
 };
@@ -169,6 +169,23 @@ static int generic_final_init(bool cold_boot)
 	return 0;
 }
 
+static unsigned long generic_cbo_block_size(void)
+{
+	if (generic_plat && generic_plat->cbo_block_size)
+		return generic_plat->cbo_block_size(generic_plat_match);
+
+	return 0;
+}
+
+static int generic_cbo_op(int op, unsigned long paddr, unsigned long size)
+{
+	if (generic_plat && generic_plat->cbo_op)
+		return generic_plat->cbo_op(op, paddr, size,
+					    generic_plat_match);
+
+	return SBI_ENOTSUPP;
+}
+
 static int generic_vendor_ext_check(long extid)
 {
 	if (generic_plat && generic_plat->vendor_ext_check)
@@ -278,6 +295,8 @@ const struct sbi_platform_operations platform_ops = {
 	.get_tlbr_flush_limit	= generic_tlbr_flush_limit,
 	.timer_init		= fdt_timer_init,
 	.timer_exit		= fdt_timer_exit,
+	.cbo_block_size		= generic_cbo_block_size,
+	.cbo_op			= generic_cbo_op,
 	.vendor_ext_check	= generic_vendor_ext_check,
 	.vendor_ext_provider	= generic_vendor_ext_provider,
 };
@@ -5,17 +5,23 @@
 #include <sbi/riscv_encoding.h>
 #include <sbi/riscv_io.h>
 #include <sbi/sbi_const.h>
+#include <sbi/sbi_domain.h>
+#include <sbi/sbi_error.h>
 #include <sbi/sbi_hart.h>
+#include <sbi/sbi_ipi.h>
 #include <sbi/sbi_platform.h>
 #include <sbi/sbi_console.h>
 #include <sbi/sbi_system.h>
 #include <sbi/sbi_trap.h>
+#include <sbi_utils/cache/thead_c9xx_cache.h>
+#include <sbi_utils/fdt/fdt_helper.h>
 #include <sbi_utils/ipi/aclint_mswi.h>
 #include <sbi_utils/irqchip/plic.h>
 #include <sbi_utils/serial/sunxi-uart.h>
 #include <sbi_utils/timer/aclint_mtimer.h>
 #include "sunxi_platform.h"
 #include "private_opensbi.h"
+#include "thead_c9xx.h"
 #include "sbi/sbi_ecall_interface.h"
 
 #define SBI_SET_WAKEUP_TIMER          (SBI_EXT_VENDOR_START + 0x1000)
@@ -48,6 +54,9 @@ extern int sbi_set_dram_crc_paras(long dram_crc_en, long dram_crc_srcaddr,
 				  long dram_crc_len);
 
 extern int c9xx_extensions_init(struct sbi_hart_features *hfeatures);
+extern int thead_c9xx_pmu_init(void *fdt);
+extern uint64_t thead_c9xx_pmu_xlate_to_mhpmevent(uint32_t event_idx,
+						  uint64_t data);
 extern int c9xx_irqchip_init(bool cold_boot);
 extern int sunxi_final_init(bool cold_boot);
 
@@ -131,6 +140,9 @@ static int c910_early_init(bool cold_boot)
 		c910_regs.pmpaddr7 = csr_read(CSR_PMPADDR7);
 		c910_regs.pmpcfg0  = csr_read(CSR_PMPCFG0);
 
+		/* Let the hardware handle misaligned accesses */
+		csr_set(CSR_MXSTATUS, THEAD_C9XX_MXSTATUS_MM);
+
 		c910_regs.mcor     = csr_read(CSR_MCOR);
 		c910_regs.mhcr     = csr_read(CSR_MHCR);
 		c910_regs.mccr2    = csr_read(CSR_MCCR2);
@@ -161,15 +173,55 @@ static int c910_early_init(bool cold_boot)
 	return 0;
 }
 
+static u32 c910_misaligned_event = SBI_IPI_EVENT_MAX;
+
+/* Apply the hardware misaligned access setting to the calling hart */
+static void c910_misaligned_process(struct sbi_scratch *scratch)
+{
+	if (c910_regs.mxstatus & THEAD_C9XX_MXSTATUS_MM)
+		csr_set(CSR_MXSTATUS, THEAD_C9XX_MXSTATUS_MM);
+	else
+		csr_clear(CSR_MXSTATUS, THEAD_C9XX_MXSTATUS_MM);
+}
+
+static struct sbi_ipi_event_ops c910_misaligned_ipi_ops = {
+	.name = "IPI_C910_MISALIGNED",
+	.process = c910_misaligned_process,
+};
+
 static int c910_final_init(bool cold_boot)
 {
+	int ret;
+
 #ifdef C910_DELEGATE_TRAPS
 	c910_delegate_traps();
 #endif
 
+	if (cold_boot) {
+		ret = sbi_ipi_event_create(&c910_misaligned_ipi_ops);
+		if (ret < 0)
+			return ret;
+		c910_misaligned_event = ret;
+	}
+
 	return sunxi_final_init(cold_boot);
 }
 
+/*
+ * Cache maintenance
+ */
+
+static unsigned long c910_cbo_block_size(void)
+{
+	return THEAD_C9XX_CACHE_LINE_SIZE;
+}
+
+/*
+ * Ranges at least this large are cleaned with a single whole cache
+ * operation on single hart systems instead of walking them line by line.
+ */
+#define C910_CACHE_RANGE_WHOLE	(64 * 1024)
+
 static int try_uart_port(void)
 {
 	unsigned int reg, port_num;
@@ -224,41 +276,28 @@ static int c910_timer_init(bool cold_boot)
 	return aclint_mtimer_warm_init();
 }
 
+static int c910_pmu_init(void)
+{
+	return thead_c9xx_pmu_init(fdt_get_address());
+}
+
+/*
+ * Legacy vendor call of the BSP kernels which read the counters without
+ * the SBI PMU extension. It programs the same fixed events as the SBI
+ * PMU event map, so both can coexist.
+ */
 void sbi_set_pmu()
 {
 	unsigned long interrupts;
+	int i;
 
 	interrupts = csr_read(CSR_MIDELEG) | (1 << 17);
 	csr_write(CSR_MIDELEG, interrupts);
 
 	/* CSR_MCOUNTEREN has already been set in mstatus_init() */
 	csr_write(CSR_MCOUNTERWEN, 0xffffffff);
-	csr_write(CSR_MHPMEVENT3, 1);
-	csr_write(CSR_MHPMEVENT4, 2);
-	csr_write(CSR_MHPMEVENT5, 3);
-	csr_write(CSR_MHPMEVENT6, 4);
-	csr_write(CSR_MHPMEVENT7, 5);
-	csr_write(CSR_MHPMEVENT8, 6);
-	csr_write(CSR_MHPMEVENT9, 7);
-	csr_write(CSR_MHPMEVENT10, 8);
-	csr_write(CSR_MHPMEVENT11, 9);
-	csr_write(CSR_MHPMEVENT12, 10);
-	csr_write(CSR_MHPMEVENT13, 11);
-	csr_write(CSR_MHPMEVENT14, 12);
-	csr_write(CSR_MHPMEVENT15, 13);
-	csr_write(CSR_MHPMEVENT16, 14);
-	csr_write(CSR_MHPMEVENT17, 15);
-	csr_write(CSR_MHPMEVENT18, 16);
-	csr_write(CSR_MHPMEVENT19, 17);
-	csr_write(CSR_MHPMEVENT20, 18);
-	csr_write(CSR_MHPMEVENT21, 19);
-	csr_write(CSR_MHPMEVENT22, 20);
-	csr_write(CSR_MHPMEVENT23, 21);
-	csr_write(CSR_MHPMEVENT24, 22);
-	csr_write(CSR_MHPMEVENT25, 23);
-	csr_write(CSR_MHPMEVENT26, 24);
-	csr_write(CSR_MHPMEVENT27, 25);
-	csr_write(CSR_MHPMEVENT28, 26);
+	for (i = 3; i <= 28; i++)
+		csr_write_num(CSR_MHPMEVENT3 + i - 3, i - 2);
 }
 
 extern void sbi_system_suspend(int state);
@@ -270,6 +309,30 @@ void sbi_boot_other_core(int hartid)
 	csr_write(CSR_MRMR, csr_read(CSR_MRMR) | (1 << hartid));
 }
 
+/*
+ * Switch hardware misaligned access on all harts, including harts
+ * started afterwards which copy c910_regs.mxstatus. With it off
+ * misaligned accesses trap and are emulated by OpenSBI, which is useful
+ * for debugging. As it affects every hart, only the root domain may
+ * change it.
+ */
+static int c910_set_hw_misaligned(unsigned long enable, unsigned long *old)
+{
+	if (c910_misaligned_event >= SBI_IPI_EVENT_MAX)
+		return SBI_ENOTSUPP;
+	if (sbi_domain_thishart_ptr() != &root)
+		return SBI_EDENIED;
+
+	*old = (c910_regs.mxstatus & THEAD_C9XX_MXSTATUS_MM) ? 1 : 0;
+	if (enable)
+		c910_regs.mxstatus |= THEAD_C9XX_MXSTATUS_MM;
+	else
+		c910_regs.mxstatus &= ~THEAD_C9XX_MXSTATUS_MM;
+	c910_misaligned_process(NULL);
+
+	return sbi_ipi_send_many(0, -1UL, c910_misaligned_event, NULL);
+}
+
 static int c910_vendor_ext_provider(long extid, long funcid,
 				const struct sbi_trap_regs *regs,
 				unsigned long *out_value,
@@ -299,6 +362,11 @@ static int c910_vendor_ext_provider(long extid, long funcid,
 #endif
 	case SBI_SET_UART_BAUDRATE:
 		break;
+	case SBI_EXT_VENDOR_C910_HW_MISALIGNED:
+		return c910_set_hw_misaligned(regs->a0, out_value);
+	case SBI_EXT_VENDOR_C910_CACHE_RANGE:
+		return thead_c9xx_cache_range(regs->a0, regs->a1,
+					      regs->a2, C910_CACHE_RANGE_WHOLE);
 #ifdef PLATFORM_XTHEAD
 	case SBI_EXT_VENDOR_C910_WAKEUP:
 		sbi_system_set_wakeup(regs->a0, regs->a1);
@@ -325,6 +393,12 @@ const struct sbi_platform_operations platform_ops = {
 
 	.timer_init          = c910_timer_init,
 
+	.pmu_init            = c910_pmu_init,
+	.pmu_xlate_to_mhpmevent = thead_c9xx_pmu_xlate_to_mhpmevent,
+
+	.cbo_block_size      = c910_cbo_block_size,
+	.cbo_op              = thead_c9xx_cbo_op,
+
 	.vendor_ext_provider = c910_vendor_ext_provider,
 };
 
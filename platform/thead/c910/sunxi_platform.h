@@ -31,6 +31,8 @@
 #define SBI_EXT_VENDOR_C910_BOOT_OTHER_CORE    0x09000003
 #define SBI_EXT_VENDOR_C910_SYSPEND            0x09000007
 #define SBI_EXT_VENDOR_C910_WAKEUP             0x09000008
+#define SBI_EXT_VENDOR_C910_HW_MISALIGNED      0x09000009
+#define SBI_EXT_VENDOR_C910_CACHE_RANGE        0x0900000a
 
 #define C910_PLIC_CLINT_OFFSET            0x04000000  /* 64M */
 #define C910_PLIC_DELEG_OFFSET            0x001ffffc
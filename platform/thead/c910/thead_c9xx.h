@@ -120,6 +120,9 @@
 #define THEAD_C9XX_CSR_T_MPCR		0xbee
 #define THEAD_C9XX_CSR_PMPTEECFG	0xbef
 
+/* T-HEAD C9xx MXSTATUS CSR fields */
+#define THEAD_C9XX_MXSTATUS_MM		(_UL(1) << 15)
+
 /* T-HEAD C9xx MIP CSR extension */
 #define THEAD_C9XX_IRQ_PMU_OVF		17
 #define THEAD_C9XX_MIP_MOIP		(_UL(1) << THEAD_C9XX_IRQ_PMU_OVF)
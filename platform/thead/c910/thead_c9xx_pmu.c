@@ -4,13 +4,58 @@
  * Copyright (c) 2022 Samuel Holland <samuel@sholland.org>
  */
 
+#include <libfdt.h>
 #include <thead_c9xx.h>
 #include <sbi/riscv_asm.h>
 #include <sbi/riscv_io.h>
 #include <sbi/sbi_bitops.h>
+#include <sbi/sbi_ecall_interface.h>
 #include <sbi/sbi_error.h>
 #include <sbi/sbi_hart.h>
 #include <sbi/sbi_pmu.h>
+#include <sbi_utils/fdt/fdt_pmu.h>
+
+/*
+ * C9xx counters have fixed events: mhpmcounterN counts the event with
+ * selector N - 2, so each event maps to exactly one counter.
+ */
+#define THEAD_C9XX_PMU_EVENT_FIRST	0x01
+#define THEAD_C9XX_PMU_EVENT_LAST	0x1a
+#define THEAD_C9XX_PMU_EVENT_CTR(sel)	BIT((sel) + 2)
+
+#define THEAD_C9XX_PMU_CACHE(cache, op, result)				\
+	(SBI_PMU_EVENT_TYPE_HW_CACHE << SBI_PMU_EVENT_IDX_OFFSET |	\
+	 SBI_PMU_HW_CACHE_##cache << SBI_PMU_EVENT_HW_CACHE_ID_OFFSET |	\
+	 SBI_PMU_HW_CACHE_OP_##op << SBI_PMU_EVENT_HW_CACHE_OPS_ID_OFFSET | \
+	 SBI_PMU_HW_CACHE_RESULT_##result)
+
+struct thead_c9xx_pmu_event {
+	uint32_t eidx;
+	uint32_t select;
+};
+
+/* Default mapping of SBI events used when the DT has no riscv,pmu node */
+static const struct thead_c9xx_pmu_event thead_c9xx_pmu_events[] = {
+	{ SBI_PMU_HW_CACHE_REFERENCES, 0x0c },
+	{ SBI_PMU_HW_CACHE_MISSES, 0x0d },
+	{ SBI_PMU_HW_BRANCH_INSTRUCTIONS, 0x07 },
+	{ SBI_PMU_HW_BRANCH_MISSES, 0x06 },
+	{ THEAD_C9XX_PMU_CACHE(L1D, READ, ACCESS), 0x0c },
+	{ THEAD_C9XX_PMU_CACHE(L1D, READ, MISS), 0x0d },
+	{ THEAD_C9XX_PMU_CACHE(L1D, WRITE, ACCESS), 0x0e },
+	{ THEAD_C9XX_PMU_CACHE(L1D, WRITE, MISS), 0x0f },
+	{ THEAD_C9XX_PMU_CACHE(L1I, READ, ACCESS), 0x01 },
+	{ THEAD_C9XX_PMU_CACHE(L1I, READ, MISS), 0x02 },
+	{ THEAD_C9XX_PMU_CACHE(LL, READ, ACCESS), 0x10 },
+	{ THEAD_C9XX_PMU_CACHE(LL, READ, MISS), 0x11 },
+	{ THEAD_C9XX_PMU_CACHE(LL, WRITE, ACCESS), 0x12 },
+	{ THEAD_C9XX_PMU_CACHE(LL, WRITE, MISS), 0x13 },
+	{ THEAD_C9XX_PMU_CACHE(DTLB, READ, MISS), 0x04 },
+	{ THEAD_C9XX_PMU_CACHE(ITLB, READ, MISS), 0x03 },
+};
+
+/* Event selectors come from the DT instead of the defaults */
+static bool thead_c9xx_pmu_fdt;
 
 static void thead_c9xx_pmu_ctr_enable_irq(uint32_t ctr_idx)
 {
@@ -56,6 +101,57 @@ const struct sbi_pmu_device thead_c9xx_pmu_device = {
 	.hw_counter_irq_bit = thead_c9xx_pmu_irq_bit,
 };
 
+int thead_c9xx_pmu_init(void *fdt)
+{
+	const struct thead_c9xx_pmu_event *evt;
+	uint32_t sel;
+	int i, rc;
+
+	/* A riscv,pmu node in the device tree replaces the defaults */
+	if (fdt && !fdt_check_header(fdt) &&
+	    fdt_node_offset_by_compatible(fdt, -1, "riscv,pmu") >= 0) {
+		thead_c9xx_pmu_fdt = TRUE;
+		return fdt_pmu_setup(fdt);
+	}
+
+	for (i = 0; i < array_size(thead_c9xx_pmu_events); i++) {
+		evt = &thead_c9xx_pmu_events[i];
+		rc = sbi_pmu_add_hw_event_counter_map(evt->eidx, evt->eidx,
+				THEAD_C9XX_PMU_EVENT_CTR(evt->select));
+		if (rc)
+			return rc;
+	}
+
+	for (sel = THEAD_C9XX_PMU_EVENT_FIRST;
+	     sel <= THEAD_C9XX_PMU_EVENT_LAST; sel++) {
+		rc = sbi_pmu_add_raw_event_counter_map(sel, -1ULL,
+				THEAD_C9XX_PMU_EVENT_CTR(sel));
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+uint64_t thead_c9xx_pmu_xlate_to_mhpmevent(uint32_t event_idx, uint64_t data)
+{
+	int i;
+
+	/* data is valid only for raw events and is equal to event selector */
+	if (event_idx == SBI_PMU_EVENT_RAW_IDX)
+		return data;
+
+	if (thead_c9xx_pmu_fdt)
+		return fdt_pmu_get_select_value(event_idx);
+
+	for (i = 0; i < array_size(thead_c9xx_pmu_events); i++) {
+		if (thead_c9xx_pmu_events[i].eidx == event_idx)
+			return thead_c9xx_pmu_events[i].select;
+	}
+
+	return 0;
+}
+
 int c9xx_extensions_init(struct sbi_hart_features *hfeatures)
 {
 	sbi_pmu_set_device(&thead_c9xx_pmu_device);